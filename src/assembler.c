@@ -0,0 +1,792 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include "assembler.h"
+
+#define BRANCH_JMP  0xEB
+#define BRANCH_CALL 0xE8
+
+typedef enum {
+    OPERAND_REG,
+    OPERAND_REG8,
+    OPERAND_IMM,
+    OPERAND_MEM,    // value(%reg)
+    OPERAND_LABEL,
+} OperandKind;
+
+typedef struct {
+    OperandKind kind;
+    int reg;            // Register, or the base of a memory operand
+    int32_t value;      // Immediate or displacement
+    const char *name;   // Label text
+    size_t nameLength;
+} Operand;
+
+// Register numbers are their index here, as used in ModRM.
+static const char *const registers32[8] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+static const char *const registers8[4] = { "al", "cl", "dl", "bl" };
+
+// Suffixes of jcc/setcc and the condition code they encode.
+static const struct {
+    const char *suffix;
+    uint8_t code;
+} conditions[] = {
+    { "o", 0x0 }, { "no", 0x1 }, { "b", 0x2 }, { "c", 0x2 }, { "nae", 0x2 },
+    { "ae", 0x3 }, { "nb", 0x3 }, { "nc", 0x3 }, { "e", 0x4 }, { "z", 0x4 },
+    { "ne", 0x5 }, { "nz", 0x5 }, { "be", 0x6 }, { "na", 0x6 }, { "a", 0x7 },
+    { "nbe", 0x7 }, { "s", 0x8 }, { "ns", 0x9 }, { "p", 0xA }, { "pe", 0xA },
+    { "np", 0xB }, { "po", 0xB }, { "l", 0xC }, { "nge", 0xC }, { "ge", 0xD },
+    { "nl", 0xD }, { "le", 0xE }, { "ng", 0xE }, { "g", 0xF }, { "nle", 0xF },
+};
+
+// Two-operand arithmetic sharing one encoding pattern. The opcode of the
+// register forms is digit * 8 + 1 or + 3; digit is also the /r of 0x81/0x83.
+static const struct {
+    const char *name;
+    uint8_t digit;
+} aluOps[] = {
+    { "add", 0 }, { "or", 1 }, { "and", 4 }, { "sub", 5 }, { "xor", 6 }, { "cmp", 7 },
+};
+
+// Grow array so it holds at least needed items.
+static void *reserveItems(void *array, size_t *capacity, size_t needed, size_t itemSize, MemCounter *mem) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    size_t oldCapacity = *capacity;
+    while (*capacity < needed) {
+        *capacity *= 2;
+    }
+    countResize(mem, oldCapacity * itemSize, *capacity * itemSize);
+    return realloc(array, *capacity * itemSize);
+}
+
+Assembler *createAssembler(Interner *names) {
+    Assembler *as = calloc(1, sizeof(Assembler));
+    as->codeCapacity = 4096;
+    as->code = malloc(as->codeCapacity);
+    as->branchCapacity = 256;
+    as->branches = malloc(as->branchCapacity * sizeof(Branch));
+    as->labelCapacity = 256;
+    as->labels = malloc(as->labelCapacity * sizeof(AsmLabel));
+    as->names = names;
+    as->labelIndex = createHashmap(as->labelCapacity);
+    as->pendingCapacity = 256;
+    as->pending = malloc(as->pendingCapacity);
+    countAlloc(&as->mem, sizeof(Assembler));
+    countAlloc(&as->mem, as->codeCapacity);
+    countAlloc(&as->mem, as->branchCapacity * sizeof(Branch));
+    countAlloc(&as->mem, as->labelCapacity * sizeof(AsmLabel));
+    countAlloc(&as->mem, as->pendingCapacity);
+    return as;
+}
+
+void freeAssembler(Assembler *as) {
+    if (as) {
+        free(as->code);
+        free(as->branches);
+        free(as->labels);
+        freeHashmap(as->labelIndex);
+        free(as->pending);
+        free(as->text);
+        free(as->relocs);
+        free(as);
+    }
+}
+
+static void asmError(Assembler *as, const char *message, const char *line, size_t length) {
+    #ifdef DEBUG
+    fprintf(stderr, "Assembler: %s on line %d: %.*s\n", message, as->line, (int)length, line);
+    #else
+    (void)line;
+    (void)length;
+    (void)message;
+    #endif
+    as->failed = 1;
+}
+
+static void emitByte(Assembler *as, uint8_t byte) {
+    as->code = reserveItems(as->code, &as->codeCapacity, as->codeLength + 1, 1, &as->mem);
+    as->code[as->codeLength++] = byte;
+}
+
+static void emit32(Assembler *as, uint32_t value) {
+    emitByte(as, value & 0xFF);
+    emitByte(as, (value >> 8) & 0xFF);
+    emitByte(as, (value >> 16) & 0xFF);
+    emitByte(as, value >> 24);
+}
+
+static int fitsByte(int32_t value) {
+    return value >= -128 && value <= 127;
+}
+
+// ModRM (and SIB/displacement) for reg and a register or memory operand.
+static void emitModRM(Assembler *as, int reg, const Operand *rm) {
+    if (rm->kind == OPERAND_REG || rm->kind == OPERAND_REG8) {
+        emitByte(as, 0xC0 | reg << 3 | rm->reg);
+        return;
+    }
+    // %ebp as a base always needs a displacement; mod 0 would mean disp32.
+    int mod = rm->value == 0 && rm->reg != 5 ? 0 : fitsByte(rm->value) ? 1 : 2;
+    emitByte(as, mod << 6 | reg << 3 | rm->reg);
+    if (rm->reg == 4) {
+        emitByte(as, 0x24); // %esp as a base goes through a SIB byte
+    }
+    if (mod == 1) {
+        emitByte(as, (uint8_t)rm->value);
+    } else if (mod == 2) {
+        emit32(as, (uint32_t)rm->value);
+    }
+}
+
+// Index of the label called name, adding it on first use.
+static uint32_t findLabel(Assembler *as, const char *name, size_t length) {
+    Symbol symbol = intern(as->names, name, length);
+    int index = getHash(as->labelIndex, symbol);
+    if (index < 0) {
+        as->labels = reserveItems(as->labels, &as->labelCapacity, as->labelCount + 1, sizeof(AsmLabel), &as->mem);
+        index = (int)as->labelCount++;
+        memset(&as->labels[index], 0, sizeof(AsmLabel));
+        as->labels[index].name = symbol;
+        insertHash(as->labelIndex, symbol, index);
+    }
+    return (uint32_t)index;
+}
+
+static void addBranch(Assembler *as, uint8_t opcode, const Operand *target) {
+    as->branches = reserveItems(as->branches, &as->branchCapacity, as->branchCount + 1, sizeof(Branch), &as->mem);
+    Branch *branch = &as->branches[as->branchCount++];
+    branch->position = (uint32_t)as->codeLength;
+    branch->label = findLabel(as, target->name, target->nameLength);
+    branch->opcode = opcode;
+    branch->isLong = opcode == BRANCH_CALL; // call has no rel8 form
+}
+
+static int isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void trim(const char **text, size_t *length) {
+    while (*length && isSpace(**text)) {
+        (*text)++;
+        (*length)--;
+    }
+    while (*length && isSpace((*text)[*length - 1])) {
+        (*length)--;
+    }
+}
+
+// Numbers as the GNU assembler reads them: decimal, 0x hex or 0 octal.
+static int parseNumber(const char *text, size_t length, int32_t *value) {
+    char digits[32];
+    if (length == 0 || length >= sizeof(digits)) {
+        return -1;
+    }
+    memcpy(digits, text, length);
+    digits[length] = '\0';
+    char *end;
+    long long parsed = strtoll(digits, &end, 0);
+    if (*end != '\0') {
+        return -1;
+    }
+    *value = (int32_t)(uint32_t)parsed;
+    return 0;
+}
+
+static int findRegister(const char *name, size_t length, const char *const *table, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strlen(table[i]) == length && memcmp(table[i], name, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int parseOperand(const char *text, size_t length, Operand *op) {
+    trim(&text, &length);
+    if (length == 0) {
+        return -1;
+    }
+    if (text[0] == '%') {
+        op->reg = findRegister(text + 1, length - 1, registers32, 8);
+        op->kind = OPERAND_REG;
+        if (op->reg < 0) {
+            op->reg = findRegister(text + 1, length - 1, registers8, 4);
+            op->kind = OPERAND_REG8;
+        }
+        return op->reg < 0 ? -1 : 0;
+    }
+    if (text[0] == '$') {
+        op->kind = OPERAND_IMM;
+        return parseNumber(text + 1, length - 1, &op->value);
+    }
+    if (text[length - 1] == ')') {
+        // disp(%base); no index registers
+        const char *open = memchr(text, '(', length);
+        if (!open || open[1] != '%') {
+            return -1;
+        }
+        op->kind = OPERAND_MEM;
+        op->value = 0;
+        if (open > text && parseNumber(text, open - text, &op->value) != 0) {
+            return -1;
+        }
+        op->reg = findRegister(open + 2, text + length - 1 - (open + 2), registers32, 8);
+        return op->reg < 0 ? -1 : 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        int ok = c == '_' || c == '.' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+              || (i > 0 && c >= '0' && c <= '9');
+        if (!ok) {
+            return -1;
+        }
+    }
+    op->kind = OPERAND_LABEL;
+    op->name = text;
+    op->nameLength = length;
+    return 0;
+}
+
+// Mnemonic is name, with or without the l size suffix.
+static int matches(const char *mnemonic, size_t length, const char *name) {
+    size_t n = strlen(name);
+    return (length == n || (length == n + 1 && mnemonic[n] == 'l'))
+        && memcmp(mnemonic, name, n) == 0;
+}
+
+static int conditionCode(const char *suffix, size_t length) {
+    for (size_t i = 0; i < sizeof(conditions) / sizeof(conditions[0]); i++) {
+        if (strlen(conditions[i].suffix) == length && memcmp(conditions[i].suffix, suffix, length) == 0) {
+            return conditions[i].code;
+        }
+    }
+    return -1;
+}
+
+static int isRM(const Operand *op) {
+    return op->kind == OPERAND_REG || op->kind == OPERAND_MEM;
+}
+
+// Encode one instruction. Returns -1 for anything outside the subset.
+static int encode(Assembler *as, const char *m, size_t length, const Operand *ops, int count) {
+    if (count == 0) {
+        if (matches(m, length, "cdq") || matches(m, length, "cltd")) {
+            emitByte(as, 0x99);
+        } else if (matches(m, length, "ret")) {
+            emitByte(as, 0xC3);
+        } else if (matches(m, length, "leave")) {
+            emitByte(as, 0xC9);
+        } else if (matches(m, length, "nop")) {
+            emitByte(as, 0x90);
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+
+    // Branches and calls
+    if (count == 1 && ops[0].kind == OPERAND_LABEL) {
+        if (matches(m, length, "jmp")) {
+            addBranch(as, BRANCH_JMP, &ops[0]);
+            return 0;
+        }
+        if (matches(m, length, "call")) {
+            addBranch(as, BRANCH_CALL, &ops[0]);
+            return 0;
+        }
+        int cc = m[0] == 'j' ? conditionCode(m + 1, length - 1) : -1;
+        if (cc < 0) {
+            return -1;
+        }
+        addBranch(as, 0x70 + cc, &ops[0]);
+        return 0;
+    }
+    if (length > 3 && memcmp(m, "set", 3) == 0) {
+        int cc = conditionCode(m + 3, length - 3);
+        if (cc < 0 || count != 1 || ops[0].kind != OPERAND_REG8) {
+            return -1;
+        }
+        emitByte(as, 0x0F);
+        emitByte(as, 0x90 + cc);
+        emitModRM(as, 0, &ops[0]);
+        return 0;
+    }
+
+    // One operand
+    if (count == 1) {
+        const Operand *op = &ops[0];
+        if (matches(m, length, "push")) {
+            if (op->kind == OPERAND_REG) {
+                emitByte(as, 0x50 + op->reg);
+            } else if (op->kind == OPERAND_IMM) {
+                if (fitsByte(op->value)) {
+                    emitByte(as, 0x6A);
+                    emitByte(as, (uint8_t)op->value);
+                } else {
+                    emitByte(as, 0x68);
+                    emit32(as, (uint32_t)op->value);
+                }
+            } else if (op->kind == OPERAND_MEM) {
+                emitByte(as, 0xFF);
+                emitModRM(as, 6, op);
+            } else {
+                return -1;
+            }
+            return 0;
+        }
+        if (matches(m, length, "pop")) {
+            if (op->kind == OPERAND_REG) {
+                emitByte(as, 0x58 + op->reg);
+            } else if (op->kind == OPERAND_MEM) {
+                emitByte(as, 0x8F);
+                emitModRM(as, 0, op);
+            } else {
+                return -1;
+            }
+            return 0;
+        }
+        // Group 3: F7 /digit
+        int digit = matches(m, length, "not") ? 2
+                  : matches(m, length, "neg") ? 3
+                  : matches(m, length, "mul") ? 4
+                  : matches(m, length, "imul") ? 5
+                  : matches(m, length, "div") ? 6
+                  : matches(m, length, "idiv") ? 7 : -1;
+        if (digit < 0 || !isRM(op)) {
+            return -1;
+        }
+        emitByte(as, 0xF7);
+        emitModRM(as, digit, op);
+        return 0;
+    }
+
+    if (count != 2) {
+        return -1;
+    }
+    const Operand *src = &ops[0];
+    const Operand *dst = &ops[1];
+    if (matches(m, length, "mov")) {
+        if (src->kind == OPERAND_IMM && dst->kind == OPERAND_REG) {
+            emitByte(as, 0xB8 + dst->reg);
+            emit32(as, (uint32_t)src->value);
+        } else if (src->kind == OPERAND_IMM && dst->kind == OPERAND_MEM) {
+            emitByte(as, 0xC7);
+            emitModRM(as, 0, dst);
+            emit32(as, (uint32_t)src->value);
+        } else if (src->kind == OPERAND_REG && isRM(dst)) {
+            emitByte(as, 0x89);
+            emitModRM(as, src->reg, dst);
+        } else if (src->kind == OPERAND_MEM && dst->kind == OPERAND_REG) {
+            emitByte(as, 0x8B);
+            emitModRM(as, dst->reg, src);
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    if (length == 6 && memcmp(m, "movzbl", 6) == 0) {
+        if ((src->kind != OPERAND_REG8 && src->kind != OPERAND_MEM) || dst->kind != OPERAND_REG) {
+            return -1;
+        }
+        emitByte(as, 0x0F);
+        emitByte(as, 0xB6);
+        emitModRM(as, dst->reg, src);
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(aluOps) / sizeof(aluOps[0]); i++) {
+        if (!matches(m, length, aluOps[i].name)) {
+            continue;
+        }
+        uint8_t digit = aluOps[i].digit;
+        if (src->kind == OPERAND_IMM && isRM(dst)) {
+            if (fitsByte(src->value)) {
+                emitByte(as, 0x83);
+                emitModRM(as, digit, dst);
+                emitByte(as, (uint8_t)src->value);
+            } else if (dst->kind == OPERAND_REG && dst->reg == 0) {
+                emitByte(as, digit * 8 + 5); // Short form for %eax
+                emit32(as, (uint32_t)src->value);
+            } else {
+                emitByte(as, 0x81);
+                emitModRM(as, digit, dst);
+                emit32(as, (uint32_t)src->value);
+            }
+        } else if (src->kind == OPERAND_REG && isRM(dst)) {
+            emitByte(as, digit * 8 + 1);
+            emitModRM(as, src->reg, dst);
+        } else if (src->kind == OPERAND_MEM && dst->kind == OPERAND_REG) {
+            emitByte(as, digit * 8 + 3);
+            emitModRM(as, dst->reg, src);
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    if (matches(m, length, "test") && src->kind == OPERAND_REG && isRM(dst)) {
+        emitByte(as, 0x85);
+        emitModRM(as, src->reg, dst);
+        return 0;
+    }
+    if (matches(m, length, "imul") && dst->kind == OPERAND_REG) {
+        if (isRM(src)) {
+            emitByte(as, 0x0F);
+            emitByte(as, 0xAF);
+            emitModRM(as, dst->reg, src);
+        } else if (src->kind == OPERAND_IMM) {
+            emitByte(as, fitsByte(src->value) ? 0x6B : 0x69);
+            emitModRM(as, dst->reg, dst);
+            if (fitsByte(src->value)) {
+                emitByte(as, (uint8_t)src->value);
+            } else {
+                emit32(as, (uint32_t)src->value);
+            }
+        } else {
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static void defineLabel(Assembler *as, const char *name, size_t length, const char *line, size_t lineLength) {
+    // findLabel may move labels, so index only once it has returned.
+    uint32_t index = findLabel(as, name, length);
+    AsmLabel *label = &as->labels[index];
+    if (label->defined) {
+        asmError(as, "label defined twice", line, lineLength);
+        return;
+    }
+    label->defined = 1;
+    label->position = (uint32_t)as->codeLength;
+    label->branches = (uint32_t)as->branchCount;
+}
+
+static void assembleLine(Assembler *as, const char *line, size_t length) {
+    as->line++;
+    const char *comment = memchr(line, '#', length);
+    if (comment) {
+        length = comment - line;
+    }
+    trim(&line, &length);
+    const char *fullLine = line;
+    size_t fullLength = length;
+
+    // Leading "name:" definitions
+    for (;;) {
+        size_t word = 0;
+        while (word < length && !isSpace(line[word]) && line[word] != ':') {
+            word++;
+        }
+        if (word == 0 || word == length || line[word] != ':') {
+            break;
+        }
+        defineLabel(as, line, word, fullLine, fullLength);
+        line += word + 1;
+        length -= word + 1;
+        trim(&line, &length);
+    }
+    if (length == 0) {
+        return;
+    }
+
+    size_t nameLength = 0;
+    while (nameLength < length && !isSpace(line[nameLength])) {
+        nameLength++;
+    }
+    const char *rest = line + nameLength;
+    size_t restLength = length - nameLength;
+    trim(&rest, &restLength);
+
+    if (line[0] == '.') {
+        if ((nameLength == 6 && memcmp(line, ".globl", 6) == 0)
+            || (nameLength == 7 && memcmp(line, ".global", 7) == 0)) {
+            if (restLength == 0) {
+                asmError(as, "missing symbol", fullLine, fullLength);
+                return;
+            }
+            uint32_t index = findLabel(as, rest, restLength);
+            as->labels[index].global = 1;
+        } else if (!(nameLength == 5 && memcmp(line, ".text", 5) == 0)) {
+            asmError(as, "unsupported directive", fullLine, fullLength);
+        }
+        return;
+    }
+
+    // Split operands at commas outside parentheses
+    Operand ops[3];
+    int count = 0;
+    size_t start = 0;
+    int depth = 0;
+    for (size_t i = 0; restLength && i <= restLength; i++) {
+        if (i < restLength && rest[i] == '(') {
+            depth++;
+        } else if (i < restLength && rest[i] == ')') {
+            depth--;
+        } else if (i == restLength || (rest[i] == ',' && depth == 0)) {
+            if (count == 3 || parseOperand(rest + start, i - start, &ops[count]) != 0) {
+                asmError(as, "bad operand", fullLine, fullLength);
+                return;
+            }
+            count++;
+            start = i + 1;
+        }
+    }
+    if (encode(as, line, nameLength, ops, count) != 0) {
+        asmError(as, "unsupported instruction", fullLine, fullLength);
+    }
+}
+
+int assembleText(Assembler *as, const char *text, size_t length) {
+    const char *end = text + length;
+    while (text < end) {
+        const char *newline = memchr(text, '\n', end - text);
+        size_t piece = (newline ? newline : end) - text;
+        if (!newline || as->pendingLength) {
+            // Keep a partial line until the rest of it arrives.
+            as->pending = reserveItems(as->pending, &as->pendingCapacity, as->pendingLength + piece, 1, &as->mem);
+            memcpy(as->pending + as->pendingLength, text, piece);
+            as->pendingLength += piece;
+            if (!newline) {
+                break;
+            }
+            assembleLine(as, as->pending, as->pendingLength);
+            as->pendingLength = 0;
+        } else {
+            assembleLine(as, text, piece);
+        }
+        text = newline + 1;
+    }
+    return as->failed;
+}
+
+static uint32_t branchSize(const Branch *branch) {
+    if (!branch->isLong) {
+        return 2;
+    }
+    return branch->opcode == BRANCH_JMP || branch->opcode == BRANCH_CALL ? 5 : 6;
+}
+
+int finishAssembly(Assembler *as) {
+    if (as->pendingLength) {
+        assembleLine(as, as->pending, as->pendingLength);
+        as->pendingLength = 0;
+    }
+    if (as->failed) {
+        return as->failed;
+    }
+
+    // Targets defined elsewhere are reached through a rel32 relocation.
+    for (size_t i = 0; i < as->branchCount; i++) {
+        if (!as->labels[as->branches[i].label].defined) {
+            as->branches[i].isLong = 1;
+        }
+    }
+
+    // Relax: every branch starts short, and any whose target is out of
+    // rel8 range becomes long. Lengthening one can push others out of
+    // range, so repeat until nothing changes; branches only ever grow.
+    // before[i] is the size of all branches ahead of branch i.
+    uint32_t *before = malloc((as->branchCount + 1) * sizeof(uint32_t));
+    for (;;) {
+        before[0] = 0;
+        for (size_t i = 0; i < as->branchCount; i++) {
+            before[i + 1] = before[i] + branchSize(&as->branches[i]);
+        }
+        for (size_t l = 0; l < as->labelCount; l++) {
+            AsmLabel *label = &as->labels[l];
+            label->address = label->position + before[label->branches];
+        }
+        int changed = 0;
+        for (size_t i = 0; i < as->branchCount; i++) {
+            Branch *branch = &as->branches[i];
+            if (branch->isLong) {
+                continue;
+            }
+            int64_t from = (int64_t)branch->position + before[i] + 2;
+            int64_t distance = (int64_t)as->labels[branch->label].address - from;
+            if (distance < -128 || distance > 127) {
+                branch->isLong = 1;
+                changed = 1;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+    }
+
+    // Lay out .text: the code between branches, with each branch encoded.
+    as->textLength = as->codeLength + before[as->branchCount];
+    as->text = malloc(as->textLength ? as->textLength : 1);
+    countAlloc(&as->mem, as->textLength);
+    size_t copied = 0;
+    unsigned char *out = as->text;
+    for (size_t i = 0; i < as->branchCount; i++) {
+        const Branch *branch = &as->branches[i];
+        memcpy(out, as->code + copied, branch->position - copied);
+        out += branch->position - copied;
+        copied = branch->position;
+
+        const AsmLabel *target = &as->labels[branch->label];
+        uint32_t size = branchSize(branch);
+        int32_t distance = (int32_t)(target->address - (branch->position + before[i] + size));
+        if (!branch->isLong) {
+            *out++ = branch->opcode;
+            *out++ = (uint8_t)distance;
+            continue;
+        }
+        if (branch->opcode == BRANCH_JMP) {
+            *out++ = 0xE9;
+        } else if (branch->opcode == BRANCH_CALL) {
+            *out++ = 0xE8;
+        } else {
+            *out++ = 0x0F;
+            *out++ = branch->opcode + 0x10; // 0x7x rel8 -> 0x0F 0x8x rel32
+        }
+        if (!target->defined) {
+            as->relocs = realloc(as->relocs, (as->relocCount + 1) * sizeof(AsmRelocation));
+            countAlloc(&as->mem, sizeof(AsmRelocation));
+            as->relocs[as->relocCount].offset = (uint32_t)(out - as->text);
+            as->relocs[as->relocCount].label = branch->label;
+            as->relocCount++;
+            distance = -4; // Implicit addend: the field is 4 bytes before the next instruction
+        }
+        memcpy(out, &distance, 4);
+        out += 4;
+    }
+    memcpy(out, as->code + copied, as->codeLength - copied);
+    free(before);
+    return 0;
+}
+
+int writeObject(const Assembler *as, const char *path) {
+    // Symbols: null, the .text section, then every global and every
+    // undefined label (the only ones relocations can refer to).
+    size_t symbolCount = 2;
+    uint32_t *symbolOf = calloc(as->labelCount ? as->labelCount : 1, sizeof(uint32_t));
+    size_t strtabSize = 1;
+    for (size_t l = 0; l < as->labelCount; l++) {
+        const AsmLabel *label = &as->labels[l];
+        if (label->global || !label->defined) {
+            symbolOf[l] = (uint32_t)symbolCount++;
+            strtabSize += strlen(symbolName(as->names, label->name)) + 1;
+        }
+    }
+    Elf32_Sym *symbols = calloc(symbolCount, sizeof(Elf32_Sym));
+    char *strtab = calloc(strtabSize, 1);
+    symbols[1].st_info = ELF32_ST_INFO(STB_LOCAL, STT_SECTION);
+    symbols[1].st_shndx = 1;
+    size_t strtabUsed = 1;
+    for (size_t l = 0; l < as->labelCount; l++) {
+        if (!symbolOf[l]) {
+            continue;
+        }
+        const AsmLabel *label = &as->labels[l];
+        const char *name = symbolName(as->names, label->name);
+        Elf32_Sym *symbol = &symbols[symbolOf[l]];
+        symbol->st_name = (Elf32_Word)strtabUsed;
+        symbol->st_value = label->defined ? label->address : 0;
+        symbol->st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        symbol->st_shndx = label->defined ? 1 : SHN_UNDEF;
+        strcpy(strtab + strtabUsed, name);
+        strtabUsed += strlen(name) + 1;
+    }
+    Elf32_Rel *rels = calloc(as->relocCount ? as->relocCount : 1, sizeof(Elf32_Rel));
+    for (size_t i = 0; i < as->relocCount; i++) {
+        rels[i].r_offset = as->relocs[i].offset;
+        rels[i].r_info = ELF32_R_INFO(symbolOf[as->relocs[i].label], R_386_PC32);
+    }
+
+    static const char shstrtab[] = "\0.text\0.rel.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+    enum { SEC_NULL, SEC_TEXT, SEC_REL, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, SEC_NOTE, SEC_COUNT };
+
+    // File layout: header, .text, .rel.text, .symtab, .strtab, .shstrtab,
+    // then the section headers, each table 4-byte aligned.
+    size_t textOffset = sizeof(Elf32_Ehdr);
+    size_t relOffset = (textOffset + as->textLength + 3) & ~(size_t)3;
+    size_t symtabOffset = relOffset + as->relocCount * sizeof(Elf32_Rel);
+    size_t strtabOffset = symtabOffset + symbolCount * sizeof(Elf32_Sym);
+    size_t shstrtabOffset = strtabOffset + strtabSize;
+    size_t headersOffset = (shstrtabOffset + sizeof(shstrtab) + 3) & ~(size_t)3;
+
+    Elf32_Ehdr header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS32;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_REL;
+    header.e_machine = EM_386;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = (Elf32_Off)headersOffset;
+    header.e_ehsize = sizeof(Elf32_Ehdr);
+    header.e_shentsize = sizeof(Elf32_Shdr);
+    header.e_shnum = SEC_COUNT;
+    header.e_shstrndx = SEC_SHSTRTAB;
+
+    Elf32_Shdr sections[SEC_COUNT];
+    memset(sections, 0, sizeof(sections));
+    sections[SEC_TEXT].sh_name = 1;
+    sections[SEC_TEXT].sh_type = SHT_PROGBITS;
+    sections[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[SEC_TEXT].sh_offset = (Elf32_Off)textOffset;
+    sections[SEC_TEXT].sh_size = (Elf32_Word)as->textLength;
+    sections[SEC_TEXT].sh_addralign = 1;
+    sections[SEC_REL].sh_name = 7;
+    sections[SEC_REL].sh_type = SHT_REL;
+    sections[SEC_REL].sh_flags = SHF_INFO_LINK;
+    sections[SEC_REL].sh_offset = (Elf32_Off)relOffset;
+    sections[SEC_REL].sh_size = (Elf32_Word)(as->relocCount * sizeof(Elf32_Rel));
+    sections[SEC_REL].sh_link = SEC_SYMTAB;
+    sections[SEC_REL].sh_info = SEC_TEXT;
+    sections[SEC_REL].sh_addralign = 4;
+    sections[SEC_REL].sh_entsize = sizeof(Elf32_Rel);
+    sections[SEC_SYMTAB].sh_name = 17;
+    sections[SEC_SYMTAB].sh_type = SHT_SYMTAB;
+    sections[SEC_SYMTAB].sh_offset = (Elf32_Off)symtabOffset;
+    sections[SEC_SYMTAB].sh_size = (Elf32_Word)(symbolCount * sizeof(Elf32_Sym));
+    sections[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    sections[SEC_SYMTAB].sh_info = 2; // First global symbol
+    sections[SEC_SYMTAB].sh_addralign = 4;
+    sections[SEC_SYMTAB].sh_entsize = sizeof(Elf32_Sym);
+    sections[SEC_STRTAB].sh_name = 25;
+    sections[SEC_STRTAB].sh_type = SHT_STRTAB;
+    sections[SEC_STRTAB].sh_offset = (Elf32_Off)strtabOffset;
+    sections[SEC_STRTAB].sh_size = (Elf32_Word)strtabSize;
+    sections[SEC_STRTAB].sh_addralign = 1;
+    sections[SEC_SHSTRTAB].sh_name = 33;
+    sections[SEC_SHSTRTAB].sh_type = SHT_STRTAB;
+    sections[SEC_SHSTRTAB].sh_offset = (Elf32_Off)shstrtabOffset;
+    sections[SEC_SHSTRTAB].sh_size = sizeof(shstrtab);
+    sections[SEC_SHSTRTAB].sh_addralign = 1;
+    sections[SEC_NOTE].sh_name = 43; // Empty: the stack needn't be executable
+    sections[SEC_NOTE].sh_type = SHT_PROGBITS;
+    sections[SEC_NOTE].sh_offset = (Elf32_Off)headersOffset;
+    sections[SEC_NOTE].sh_addralign = 1;
+
+    FILE *file = fopen(path, "wb");
+    int failed = !file;
+    if (file) {
+        static const char zeros[4] = { 0 };
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(as->text, 1, as->textLength, file);
+        fwrite(zeros, 1, relOffset - (textOffset + as->textLength), file);
+        fwrite(rels, sizeof(Elf32_Rel), as->relocCount, file);
+        fwrite(symbols, sizeof(Elf32_Sym), symbolCount, file);
+        fwrite(strtab, 1, strtabSize, file);
+        fwrite(shstrtab, 1, sizeof(shstrtab), file);
+        fwrite(zeros, 1, headersOffset - (shstrtabOffset + sizeof(shstrtab)), file);
+        fwrite(sections, sizeof(Elf32_Shdr), SEC_COUNT, file);
+        failed = ferror(file);
+        if (fclose(file) != 0) {
+            failed = 1;
+        }
+    }
+    free(symbolOf);
+    free(symbols);
+    free(strtab);
+    free(rels);
+    return failed ? -1 : 0;
+}
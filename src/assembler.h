@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include "data.h"
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+// Built-in assembler for the subset of 32-bit AT&T syntax the generator
+// emits. Text is fed in as it is produced; each instruction is encoded on
+// the spot except branches, which are sized once every label is known.
+// The result is .text plus its symbols, written out as an ELF object.
+
+// A branch or call whose size isn't settled until all labels are known.
+typedef struct {
+    uint32_t position;      // Offset in code where the branch goes
+    uint32_t label;         // Target, an index into labels
+    uint8_t opcode;         // BRANCH_JMP, BRANCH_CALL or 0x70 + condition
+    uint8_t isLong;         // rel32 rather than rel8
+} Branch;
+
+typedef struct {
+    Symbol name;
+    uint32_t position;      // Offset in code of the definition
+    uint32_t branches;      // Branches emitted before the definition
+    uint32_t address;       // Offset in the final .text
+    uint8_t defined;
+    uint8_t global;
+} AsmLabel;
+
+// A rel32 field in .text that refers to a symbol defined elsewhere.
+typedef struct {
+    uint32_t offset;
+    uint32_t label;
+} AsmRelocation;
+
+typedef struct {
+    unsigned char *code;    // Everything but the branches
+    size_t codeLength, codeCapacity;
+    Branch *branches;
+    size_t branchCount, branchCapacity;
+    Interner *names;        // Interns label names; shared, not owned
+    HashMap *labelIndex;    // Name's symbol -> index into labels
+    AsmLabel *labels;       // In order of first use
+    size_t labelCount, labelCapacity;
+    char *pending;          // A line split across two assembleText calls
+    size_t pendingLength, pendingCapacity;
+    int line;               // Lines seen so far, for messages
+    int failed;             // Set on anything the encoder doesn't handle
+    unsigned char *text;    // Final .text, set by finishAssembly
+    size_t textLength;
+    AsmRelocation *relocs;
+    size_t relocCount;
+    MemCounter mem;
+} Assembler;
+
+Assembler *createAssembler(Interner *names);
+void freeAssembler(Assembler *as);
+// Encode the complete lines in text; a trailing partial line is kept
+// for the next call. Returns nonzero once anything has failed.
+int assembleText(Assembler *as, const char *text, size_t length);
+// Size branches, resolve labels and lay out .text.
+int finishAssembly(Assembler *as);
+// Write the finished .text as an ELF32 relocatable object.
+int writeObject(const Assembler *as, const char *path);
+#endif
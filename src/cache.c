@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+// Bump whenever the node layout or anything in this file's format changes.
+#define CACHE_VERSION 1
+
+// File layout: header, nodes, child lists, symbol lengths, symbol text.
+// Symbols are written in interner order, so re-interning them into a
+// fresh interner gives back the same Symbol numbers the nodes refer to.
+typedef struct {
+    char magic[4];          // "C3AS"
+    uint32_t version;
+    uint32_t nodeSize;      // sizeof(ASTNode) of the writer
+    uint32_t nodeCount;
+    uint32_t listCount;
+    NodeIndex root;
+    uint32_t symbolCount;
+    uint32_t textBytes;
+    uint64_t sourceHash;
+    uint64_t sourceLength;
+} CacheHeader;
+
+// FNV-1a over the source bytes.
+static uint64_t hashSource(const Source *source) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < source->length; i++) {
+        hash ^= (unsigned char)source->data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// What a child reference has to be, given where it sits in its parent.
+typedef enum {
+    SLOT_PROGRAM,       // The root
+    SLOT_FUNCTION,      // An entry of the program list
+    SLOT_BODY,          // A function's body
+    SLOT_STATEMENT,     // Block entry, if/for body; may be NO_NODE
+    SLOT_EXPRESSION,    // May be NO_NODE, which reads as the zeroed node 0
+} Slot;
+
+typedef struct {
+    const CacheHeader *header;
+    const ASTNode *nodes;
+    const NodeIndex *lists;
+    uint8_t *seen;
+    NodeIndex *pending;     // Nodes whose own children are still unchecked
+    uint32_t pendingCount;
+} TreeCheck;
+
+// Queue child for checking. It must be NO_NODE (where the slot allows
+// it) or an existing node referenced nowhere else, so whatever hangs off
+// the root is a tree, and its type must fit the slot.
+static int checkChild(TreeCheck *check, NodeIndex child, Slot slot) {
+    if (child == NO_NODE) {
+        return slot == SLOT_STATEMENT || slot == SLOT_EXPRESSION;
+    }
+    if (child >= check->header->nodeCount || check->seen[child]) {
+        return 0;
+    }
+    uint8_t type = check->nodes[child].type;
+    int fits;
+    switch (slot) {
+        case SLOT_PROGRAM:
+            fits = type == AST_PROGRAM;
+            break;
+        case SLOT_FUNCTION:
+            fits = type == AST_FUNCTION;
+            break;
+        case SLOT_BODY:
+            fits = type == AST_BLOCK;
+            break;
+        case SLOT_STATEMENT:
+            fits = type == AST_BLOCK || type == AST_DECL || type == AST_RETURN
+                || type == AST_IF || type == AST_FOR || type == AST_TERNARY
+                || type == AST_CONSTANT || type == AST_UNARY
+                || type == AST_BINARY || type == AST_IDENTIFIER;
+            break;
+        default:
+            fits = type == AST_TERNARY || type == AST_CONSTANT || type == AST_UNARY
+                || type == AST_BINARY || type == AST_IDENTIFIER;
+            break;
+    }
+    if (!fits) {
+        return 0;
+    }
+    check->seen[child] = 1;
+    check->pending[check->pendingCount++] = child;
+    return 1;
+}
+
+static int checkList(TreeCheck *check, uint32_t first, uint32_t count, Slot slot) {
+    if ((uint64_t)first + count > check->header->listCount) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!checkChild(check, check->lists[first + i], slot)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int validSymbol(Symbol symbol, const CacheHeader *header) {
+    return symbol >= 0 && (uint32_t)symbol < header->symbolCount;
+}
+
+// Check a mapped tree before anything walks it. Starting from the root,
+// every node's type has to fit where it sits, and its operators,
+// symbols, child indices and list ranges have to be in bounds. A file
+// that passes the header checks can still be corrupt, and codegen
+// follows and indexes tables with these fields unchecked.
+static int validTree(const CacheHeader *header, const ASTNode *nodes, const NodeIndex *lists) {
+    uint32_t count = header->nodeCount;
+    // Node 0 stands for NO_NODE and is read as an empty expression.
+    static const ASTNode empty;
+    if (count == 0 || memcmp(&nodes[NO_NODE], &empty, sizeof(ASTNode)) != 0) {
+        return 0;
+    }
+    TreeCheck check = { header, nodes, lists, calloc(count, 1),
+                        malloc(count * sizeof(NodeIndex)), 0 };
+    int valid = checkChild(&check, header->root, SLOT_PROGRAM);
+    while (valid && check.pendingCount > 0) {
+        check.pendingCount--;
+        const ASTNode *node = &nodes[check.pending[check.pendingCount]];
+        switch (node->type) {
+            case AST_PROGRAM:
+                valid = checkList(&check, node->program.first, node->program.count, SLOT_FUNCTION);
+                break;
+            case AST_FUNCTION:
+                valid = validSymbol(node->function.name, header)
+                    && checkChild(&check, node->function.body, SLOT_BODY);
+                break;
+            case AST_BLOCK:
+                valid = checkList(&check, node->block.first, node->block.count, SLOT_STATEMENT);
+                break;
+            case AST_DECL:
+                valid = validSymbol(node->decl.name, header)
+                    && checkChild(&check, node->decl.initializer, SLOT_EXPRESSION);
+                break;
+            case AST_IF:
+                valid = checkChild(&check, node->ifstmt.condition, SLOT_EXPRESSION)
+                    && checkChild(&check, node->ifstmt.body, SLOT_STATEMENT)
+                    && checkChild(&check, node->ifstmt.elsestmt, SLOT_STATEMENT);
+                break;
+            case AST_FOR: {
+                uint32_t parts = node->forstmt.parts;
+                valid = (uint64_t)parts + 4 <= header->listCount
+                    && checkChild(&check, lists[parts], SLOT_EXPRESSION)
+                    && checkChild(&check, lists[parts + 1], SLOT_EXPRESSION)
+                    && checkChild(&check, lists[parts + 2], SLOT_EXPRESSION)
+                    && checkChild(&check, lists[parts + 3], SLOT_STATEMENT);
+                break;
+            }
+            case AST_RETURN:
+                valid = checkChild(&check, node->retn.expression, SLOT_EXPRESSION);
+                break;
+            case AST_TERNARY:
+                valid = checkChild(&check, node->ternary.condition, SLOT_EXPRESSION)
+                    && checkChild(&check, node->ternary.trueCond, SLOT_EXPRESSION)
+                    && checkChild(&check, node->ternary.falseCond, SLOT_EXPRESSION);
+                break;
+            case AST_CONSTANT:
+                valid = validSymbol(node->constant.value, header);
+                break;
+            case AST_UNARY:
+                valid = (uint32_t)node->unary.op <= TOKEN_INVALID
+                    && checkChild(&check, node->unary.operand, SLOT_EXPRESSION);
+                break;
+            case AST_BINARY:
+                valid = (uint32_t)node->binary.op <= TOKEN_INVALID
+                    && checkChild(&check, node->binary.left, SLOT_EXPRESSION)
+                    && checkChild(&check, node->binary.right, SLOT_EXPRESSION);
+                break;
+            case AST_IDENTIFIER:
+                valid = validSymbol(node->identifier.symbol, header);
+                break;
+            default:
+                valid = 0; // checkChild already turned away every other type
+                break;
+        }
+    }
+    free(check.seen);
+    free(check.pending);
+    return valid;
+}
+
+static void cachePath(const CompilerContext *ctx, uint64_t hash, char *path, size_t size) {
+    snprintf(path, size, "%s/%016llx.ast", ctx->cacheDir, (unsigned long long)hash);
+}
+
+AST *loadCachedAST(CompilerContext *ctx) {
+    if (!ctx->cacheDir) {
+        return NULL;
+    }
+    uint64_t hash = hashSource(ctx->source);
+    char path[1024];
+    cachePath(ctx, hash, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        ctx->cacheMisses++;
+        return NULL;
+    }
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)) {
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) {
+        ctx->cacheMisses++;
+        return NULL;
+    }
+
+    const CacheHeader *header = base;
+    const char *nodes = (const char *)base + sizeof(CacheHeader);
+    const char *lists = nodes + (size_t)header->nodeCount * sizeof(ASTNode);
+    const uint32_t *lengths = (const uint32_t *)(lists + (size_t)header->listCount * sizeof(NodeIndex));
+    const char *text = (const char *)(lengths + header->symbolCount);
+    if (memcmp(header->magic, "C3AS", 4) != 0
+        || header->version != CACHE_VERSION
+        || header->nodeSize != sizeof(ASTNode)
+        || header->sourceHash != hash
+        || header->sourceLength != ctx->source->length
+        || (size_t)st.st_size != (size_t)(text - (const char *)base) + header->textBytes
+        || !validTree(header, (const ASTNode *)nodes, (const NodeIndex *)lists)) {
+        munmap(base, st.st_size);
+        ctx->cacheMisses++;
+        return NULL;
+    }
+
+    const char *textEnd = text + header->textBytes;
+    for (uint32_t i = 0; i < header->symbolCount; i++) {
+        if (lengths[i] > (size_t)(textEnd - text)
+            || intern(ctx->interner, text, lengths[i]) != (Symbol)i) {
+            // Interner already held other strings; numbering won't line up.
+            munmap(base, st.st_size);
+            ctx->cacheMisses++;
+            return NULL;
+        }
+        text += lengths[i];
+    }
+
+    // The tree is used straight out of the mapping; freeAST unmaps it.
+    AST *ast = malloc(sizeof(AST));
+    ast->nodes = (ASTNode *)nodes;
+    ast->nodeCount = ast->nodeCapacity = header->nodeCount;
+    ast->lists = (NodeIndex *)lists;
+    ast->listCount = ast->listCapacity = header->listCount;
+    ast->root = header->root;
+    ast->mapping = base;
+    ast->mappingSize = st.st_size;
+    memset(&ast->nodeMem, 0, sizeof(MemCounter));
+    memset(&ast->listMem, 0, sizeof(MemCounter));
+    countAlloc(&ast->nodeMem, sizeof(AST));
+    ctx->cacheHits++;
+    return ast;
+}
+
+void storeCachedAST(CompilerContext *ctx, const AST *ast) {
+    if (!ctx->cacheDir) {
+        return;
+    }
+    if (mkdir(ctx->cacheDir, 0777) != 0 && errno != EEXIST) {
+        return;
+    }
+    uint64_t hash = hashSource(ctx->source);
+    char path[1024], temp[1100];
+    cachePath(ctx, hash, path, sizeof(path));
+    // A unique name: other threads of this process may be storing the
+    // same source right now.
+    snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        return;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(temp);
+        return;
+    }
+    const Interner *interner = ctx->interner;
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "C3AS", 4);
+    header.version = CACHE_VERSION;
+    header.nodeSize = sizeof(ASTNode);
+    header.nodeCount = ast->nodeCount;
+    header.listCount = ast->listCount;
+    header.root = ast->root;
+    header.symbolCount = interner->count;
+    header.sourceHash = hash;
+    header.sourceLength = ctx->source->length;
+    for (size_t i = 0; i < interner->count; i++) {
+        header.textBytes += strlen(interner->strings[i]);
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(ast->nodes, sizeof(ASTNode), ast->nodeCount, file);
+    fwrite(ast->lists, sizeof(NodeIndex), ast->listCount, file);
+    for (size_t i = 0; i < interner->count; i++) {
+        uint32_t length = strlen(interner->strings[i]);
+        fwrite(&length, sizeof(length), 1, file);
+    }
+    for (size_t i = 0; i < interner->count; i++) {
+        fputs(interner->strings[i], file);
+    }
+
+    // Publish with a rename so readers never see a partial entry.
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed || rename(temp, path) != 0) {
+        unlink(temp);
+    }
+}
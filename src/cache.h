@@ -0,0 +1,15 @@
+#include "parser.h"
+#ifndef CACHE_H
+#define CACHE_H
+
+// On-disk cache of parsed ASTs, keyed by a hash of the source bytes.
+// Entries live in ctx->cacheDir as <hash>.ast; with no cache directory
+// both calls do nothing.
+
+// Map the cached tree for ctx's source and intern its strings into
+// ctx->interner. NULL on a miss or an unusable entry.
+AST *loadCachedAST(CompilerContext *ctx);
+// Write ast as the entry for ctx's source. Failures are not fatal.
+void storeCachedAST(CompilerContext *ctx, const AST *ast);
+
+#endif
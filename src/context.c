@@ -0,0 +1,29 @@
+#include <stdlib.h>
+#include "context.h"
+
+// Open the source and set up the shared tables; NULL if the file can't be read.
+CompilerContext *createContext(const char *filename) {
+    Source *source = openSource(filename);
+    if (!source) {
+        return NULL;
+    }
+    CompilerContext *ctx = malloc(sizeof(CompilerContext));
+    ctx->filename = filename;
+    ctx->source = source;
+    ctx->interner = createInterner();
+    ctx->cacheDir = getenv("C3_CACHE_DIR");
+    if (ctx->cacheDir && !*ctx->cacheDir) {
+        ctx->cacheDir = NULL;
+    }
+    ctx->cacheHits = 0;
+    ctx->cacheMisses = 0;
+    return ctx;
+}
+
+void freeContext(CompilerContext *ctx) {
+    if (ctx) {
+        closeSource(ctx->source);
+        freeInterner(ctx->interner);
+        free(ctx);
+    }
+}
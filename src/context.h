@@ -0,0 +1,19 @@
+#include "lexer.h"
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+// Everything one compile shares across phases. Nothing in the compiler
+// keeps state outside of a context (and the phase objects built from it),
+// so separate compiles can run side by side in one process.
+typedef struct {
+    const char *filename;
+    Source *source;       // Text being compiled; tokens point into it
+    Interner *interner;   // Identifier symbols for the whole compile
+    const char *cacheDir; // AST cache directory, NULL if caching is off
+    int cacheHits;        // AST cache lookups that skipped lex and parse
+    int cacheMisses;
+} CompilerContext;
+
+CompilerContext *createContext(const char *filename);
+void freeContext(CompilerContext *ctx);
+#endif
@@ -5,186 +5,392 @@
 
 // TODO: re-implement using search trees to pass funky testcases
 
-// Hash function to compute index for a key
-static size_t hash(const char* key, size_t capacity) {
-    size_t hash_value = 0;
-    for (size_t i = 0; key[i] != '\0'; i++) {
-        hash_value = (hash_value * 31) + key[i];
+#define ARENA_ALIGN 8
+
+// Create an arena that grabs memory from malloc blockSize bytes at a time
+Arena* createArena(size_t blockSize) {
+    Arena* arena = (Arena*)malloc(sizeof(Arena));
+    arena->head = NULL;
+    arena->blockSize = blockSize;
+    arena->allocations = 0;
+    arena->bytes = 0;
+    memset(&arena->mem, 0, sizeof(MemCounter));
+    countAlloc(&arena->mem, sizeof(Arena));
+    return arena;
+}
+
+// Release every allocation made from the arena at once
+void freeArena(Arena* arena) {
+    if (arena) {
+        ArenaBlock* block = arena->head;
+        while (block) {
+            ArenaBlock* next = block->next;
+            free(block);
+            block = next;
+        }
+        free(arena);
+    }
+}
+
+// Allocate zeroed memory from the arena
+void* arenaAlloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    ArenaBlock* block = arena->head;
+    if (!block || block->used + size > block->size) {
+        size_t blockSize = size > arena->blockSize ? size : arena->blockSize;
+        block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+        countAlloc(&arena->mem, sizeof(ArenaBlock) + blockSize);
+        block->used = 0;
+        block->size = blockSize;
+        block->next = arena->head;
+        arena->head = block;
     }
-    return hash_value % capacity;
+    void* ptr = block->data + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+    arena->allocations++;
+    arena->bytes += size;
+    return ptr;
+}
+
+// Copy length bytes of text into the arena as a C string
+char* arenaStrndup(Arena* arena, const char* text, size_t length) {
+    char* copy = (char*)arenaAlloc(arena, length + 1);
+    memcpy(copy, text, length);
+    return copy;
+}
+
+// Hash function for interned text: multiply-mix eight bytes at a time
+static uint32_t hashText(const char* text, size_t length) {
+    uint64_t h = 0x243f6a8885a308d3ULL ^ length;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, text, 8);
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 32;
+        text += 8;
+        length -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, text, length);
+    h = (h ^ tail) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    return (uint32_t)h;
+}
+
+// Home slot of a symbol: Fibonacci hashing, i.e. multiply by 2^32 / phi
+// and keep the top bits. Every bit of the symbol reaches the slot, so
+// separate runs of ids (function names, then generated labels) spread
+// over the table instead of piling up modulo its size.
+static inline size_t hashSymbol(const HashMap* hashmap, Symbol key) {
+    return (uint32_t)(key * 0x9E3779B1u) >> hashmap->shift;
+}
+
+// Create an empty interner
+Interner* createInterner() {
+    Interner* interner = (Interner*)malloc(sizeof(Interner));
+    interner->count = 0;
+    interner->capacity = 64;
+    interner->strings = (char**)malloc(interner->capacity * sizeof(char*));
+    interner->text = createArena(16 * 1024);
+    interner->tableCapacity = 128;
+    memset(&interner->mem, 0, sizeof(MemCounter));
+    countAlloc(&interner->mem, sizeof(Interner));
+    countAlloc(&interner->mem, interner->capacity * sizeof(char*));
+    countAlloc(&interner->mem, interner->tableCapacity * sizeof(InternSlot));
+    interner->table = (InternSlot*)malloc(interner->tableCapacity * sizeof(InternSlot));
+    for (size_t i = 0; i < interner->tableCapacity; i++) {
+        interner->table[i].symbol = NO_SYMBOL;
+    }
+    return interner;
+}
+
+// Free the interner and every string it owns
+void freeInterner(Interner* interner) {
+    if (interner) {
+        freeArena(interner->text);
+        free(interner->strings);
+        free(interner->table);
+        free(interner);
+    }
+}
+
+// Double the index and re-insert every symbol by its cached hash
+static void growInterner(Interner* interner) {
+    InternSlot* old = interner->table;
+    size_t oldCapacity = interner->tableCapacity;
+    countFree(&interner->mem, oldCapacity * sizeof(InternSlot));
+    interner->tableCapacity *= 2;
+    interner->table = (InternSlot*)malloc(interner->tableCapacity * sizeof(InternSlot));
+    countAlloc(&interner->mem, interner->tableCapacity * sizeof(InternSlot));
+    for (size_t i = 0; i < interner->tableCapacity; i++) {
+        interner->table[i].symbol = NO_SYMBOL;
+    }
+    size_t mask = interner->tableCapacity - 1;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].symbol == NO_SYMBOL) {
+            continue;
+        }
+        size_t index = old[i].hash & mask;
+        while (interner->table[index].symbol != NO_SYMBOL) {
+            index = (index + 1) & mask;
+        }
+        interner->table[index] = old[i];
+    }
+    free(old);
+}
+
+// Return the symbol for text, creating it on first sight
+Symbol intern(Interner* interner, const char* text, size_t length) {
+    uint32_t h = hashText(text, length);
+    size_t mask = interner->tableCapacity - 1;
+    size_t index = h & mask;
+    while (interner->table[index].symbol != NO_SYMBOL) {
+        if (interner->table[index].hash == h) {
+            Symbol candidate = interner->table[index].symbol;
+            const char* existing = interner->strings[candidate];
+            if (strncmp(existing, text, length) == 0 && existing[length] == '\0') {
+                return candidate;
+            }
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (interner->count == interner->capacity) {
+        interner->capacity *= 2;
+        interner->strings = (char**)realloc(interner->strings, interner->capacity * sizeof(char*));
+        countResize(&interner->mem, interner->capacity / 2 * sizeof(char*), interner->capacity * sizeof(char*));
+    }
+    Symbol symbol = (Symbol)interner->count++;
+    interner->strings[symbol] = arenaStrndup(interner->text, text, length);
+    interner->table[index].symbol = symbol;
+    interner->table[index].hash = h;
+
+    // Keep the index at most half full
+    if (interner->count * 2 > interner->tableCapacity) {
+        growInterner(interner);
+    }
+    return symbol;
+}
+
+// Text of an interned symbol
+const char* symbolName(const Interner* interner, Symbol symbol) {
+    return interner->strings[symbol];
 }
 
-// Create a new HashMap with the specified capacity
+// Create a new HashMap with room for at least capacity slots
 HashMap* createHashmap(size_t capacity) {
     HashMap* hashmap = (HashMap*)malloc(sizeof(HashMap));
-    hashmap->capacity = capacity;
+    hashmap->capacity = 8;
+    hashmap->shift = 29;
+    while (hashmap->capacity < capacity) {
+        hashmap->capacity *= 2;
+        hashmap->shift--;
+    }
     hashmap->size = 0;
-    hashmap->entries = (HashMapEntry*)calloc(capacity, sizeof(HashMapEntry));
+    hashmap->entries = (HashMapEntry*)malloc(hashmap->capacity * sizeof(HashMapEntry));
+    for (size_t i = 0; i < hashmap->capacity; i++) {
+        hashmap->entries[i].key = NO_SYMBOL;
+    }
+    memset(&hashmap->mem, 0, sizeof(MemCounter));
+    countAlloc(&hashmap->mem, sizeof(HashMap));
+    countAlloc(&hashmap->mem, hashmap->capacity * sizeof(HashMapEntry));
     return hashmap;
 }
 
 // Free the memory allocated for the HashMap
 void freeHashmap(HashMap* hashmap) {
     if (hashmap) {
-        for (size_t i = 0; i < hashmap->capacity; i++) {
-            if (hashmap->entries[i].key != NULL) {
-                free(hashmap->entries[i].key);
-            }
-        }
         free(hashmap->entries);
         free(hashmap);
     }
 }
 
-// Get the value associated with a key in the HashMap
-int getHash(HashMap* hashmap, const char* key) {
-    size_t index = hash(key, hashmap->capacity);
-    for (size_t i = 0; i < hashmap->capacity; i++) {
-        size_t probe_index = (index + i) % hashmap->capacity;
-        if (hashmap->entries[probe_index].key == NULL) {
-            return -1; // Key not found
+// How far the entry in slot sits from its home slot
+static inline size_t probeDistance(const HashMap* hashmap, size_t slot, Symbol key) {
+    return (slot - hashSymbol(hashmap, key)) & (hashmap->capacity - 1);
+}
+
+// Slot holding key, or -1. A resident closer to home than we have
+// walked means key would have displaced it, so it isn't here.
+static long findSlot(const HashMap* hashmap, Symbol key) {
+    size_t mask = hashmap->capacity - 1;
+    size_t slot = hashSymbol(hashmap, key);
+    for (size_t distance = 0; ; distance++) {
+        const HashMapEntry* entry = &hashmap->entries[slot];
+        if (entry->key == NO_SYMBOL || probeDistance(hashmap, slot, entry->key) < distance) {
+            return -1;
         }
-        if (strcmp(hashmap->entries[probe_index].key, key) == 0) {
-            return hashmap->entries[probe_index].value;
+        if (entry->key == key) {
+            return (long)slot;
         }
+        slot = (slot + 1) & mask;
     }
-    return -1; // Key not found
 }
 
-// Insert or update a key-value pair in the HashMap
-int insertHash(HashMap* hashmap, const char* key, int value) {
-    if (hashmap->size >= hashmap->capacity) {
-        return -1; // HashMap is full
-    }
+// Get the value associated with a key in the HashMap
+int getHash(HashMap* hashmap, Symbol key) {
+    long slot = findSlot(hashmap, key);
+    return slot < 0 ? -1 : hashmap->entries[slot].value;
+}
 
-    size_t index = hash(key, hashmap->capacity);
-    for (size_t i = 0; i < hashmap->capacity; i++) {
-        size_t probe_index = (index + i) % hashmap->capacity;
-        if (hashmap->entries[probe_index].key == NULL) {
-            hashmap->entries[probe_index].key = strdup(key);
-            hashmap->entries[probe_index].value = value;
+// Place an entry, taking the slot of any resident closer to its home
+// and carrying that resident on instead. Until the first swap, a
+// resident with the same key is updated in place.
+static void placeEntry(HashMap* hashmap, HashMapEntry incoming) {
+    size_t mask = hashmap->capacity - 1;
+    size_t slot = hashSymbol(hashmap, incoming.key);
+    int carrying = 0;
+    for (size_t distance = 0; ; distance++) {
+        HashMapEntry* entry = &hashmap->entries[slot];
+        if (entry->key == NO_SYMBOL) {
+            *entry = incoming;
             hashmap->size++;
-            return 0;
+            return;
+        }
+        if (!carrying && entry->key == incoming.key) {
+            entry->value = incoming.value;
+            return;
         }
-        if (strcmp(hashmap->entries[probe_index].key, key) == 0) {
-            hashmap->entries[probe_index].value = value;
-            return 0;
+        size_t resident = probeDistance(hashmap, slot, entry->key);
+        if (resident < distance) {
+            HashMapEntry displaced = *entry;
+            *entry = incoming;
+            incoming = displaced;
+            distance = resident;
+            carrying = 1;
         }
+        slot = (slot + 1) & mask;
     }
-    return -1; // HashMap is full (shouldn't reach here if size check is correct)
 }
 
-// Remove a key-value pair from the HashMap
-int removeHash(HashMap* hashmap, const char* key) {
-    size_t index = hash(key, hashmap->capacity);
+// Double the entry array and re-place every entry
+static void growHashmap(HashMap* hashmap) {
+    HashMapEntry* old = hashmap->entries;
+    size_t oldCapacity = hashmap->capacity;
+    hashmap->capacity *= 2;
+    hashmap->shift--;
+    hashmap->entries = (HashMapEntry*)malloc(hashmap->capacity * sizeof(HashMapEntry));
+    countFree(&hashmap->mem, oldCapacity * sizeof(HashMapEntry));
+    countAlloc(&hashmap->mem, hashmap->capacity * sizeof(HashMapEntry));
     for (size_t i = 0; i < hashmap->capacity; i++) {
-        size_t probe_index = (index + i) % hashmap->capacity;
-        if (hashmap->entries[probe_index].key == NULL) {
-            return -1; // Key not found
-        }
-        if (strcmp(hashmap->entries[probe_index].key, key) == 0) {
-            free(hashmap->entries[probe_index].key);
-            hashmap->entries[probe_index].key = NULL;
-            hashmap->entries[probe_index].value = -1;
-            hashmap->size--;
-            return 0;
+        hashmap->entries[i].key = NO_SYMBOL;
+    }
+    hashmap->size = 0;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].key != NO_SYMBOL) {
+            placeEntry(hashmap, old[i]);
         }
     }
-    return -1; // Key not found
+    free(old);
 }
 
-// Copy contents from src hashmap to dest hashmap
-int copyHashMap(HashMap* dest, const HashMap* src) {
-    if (dest == NULL || src == NULL) return -1;
-
-    // Check that the destination has enough capacity
-    if (dest->capacity < src->capacity) {
-        return -1; // Not enough capacity in the destination
+// Insert or update a key-value pair in the HashMap
+int insertHash(HashMap* hashmap, Symbol key, int value) {
+    // Robin Hood probing keeps probe runs short up to 7/8 full
+    if ((hashmap->size + 1) * 8 > hashmap->capacity * 7) {
+        growHashmap(hashmap);
     }
+    HashMapEntry entry = { key, value };
+    placeEntry(hashmap, entry);
+    return 0;
+}
 
-    // Clear destination first
-    for (size_t i = 0; i < dest->capacity; i++) {
-        if (dest->entries[i].key != NULL) {
-            free(dest->entries[i].key);
-            dest->entries[i].key = NULL;
-            dest->entries[i].value = -1;
-        }
+// Remove a key-value pair from the HashMap, shifting the rest of its
+// probe run back one slot so no chain is left broken
+int removeHash(HashMap* hashmap, Symbol key) {
+    long found = findSlot(hashmap, key);
+    if (found < 0) {
+        return -1; // Key not found
     }
-    dest->size = 0;
-
-    // Copy over entries from source
-    for (size_t i = 0; i < src->capacity; i++) {
-        if (src->entries[i].key != NULL) {
-            insertHash(dest, src->entries[i].key, src->entries[i].value);
-        }
+    size_t mask = hashmap->capacity - 1;
+    size_t slot = (size_t)found;
+    size_t next = (slot + 1) & mask;
+    while (hashmap->entries[next].key != NO_SYMBOL
+           && probeDistance(hashmap, next, hashmap->entries[next].key) > 0) {
+        hashmap->entries[slot] = hashmap->entries[next];
+        slot = next;
+        next = (next + 1) & mask;
     }
-
+    hashmap->entries[slot].key = NO_SYMBOL;
+    hashmap->size--;
     return 0;
 }
 
-
-// Create a new stack
-Stack* createStack() {
-    Stack* stack = (Stack*)malloc(sizeof(Stack));
-    stack->size = 0;
-    stack->capacity = 4;  // Initial capacity
-    stack->array = (HashMap**)malloc(stack->capacity * sizeof(HashMap*));
-    return stack;
-}
-// Free the memory allocated for the stack
-void freeStack(Stack* stack) {
-    if (stack) {
-        free(stack->array);
-        free(stack);
-    }
+// Create a scope table with no scopes open
+ScopeTable* createScopeTable() {
+    ScopeTable* table = (ScopeTable*)malloc(sizeof(ScopeTable));
+    table->visible = createHashmap(64);
+    table->count = 0;
+    table->capacity = 64;
+    table->bindings = (Binding*)malloc(table->capacity * sizeof(Binding));
+    table->depth = 0;
+    table->markCapacity = 16;
+    table->marks = (size_t*)malloc(table->markCapacity * sizeof(size_t));
+    memset(&table->mem, 0, sizeof(MemCounter));
+    countAlloc(&table->mem, sizeof(ScopeTable));
+    countAlloc(&table->mem, table->capacity * sizeof(Binding));
+    countAlloc(&table->mem, table->markCapacity * sizeof(size_t));
+    return table;
 }
 
-// Push a value onto the stack
-int stackPush(Stack* stack, HashMap* value) {
-    // If stack is full, resize it
-    if (stack->size == stack->capacity) {
-        stackResize(stack, stack->capacity * 2);  // Double the capacity
+// Free the table and its map
+void freeScopeTable(ScopeTable* table) {
+    if (table) {
+        freeHashmap(table->visible);
+        free(table->bindings);
+        free(table->marks);
+        free(table);
     }
-    stack->array[stack->size++] = value;
-    return 0;
 }
 
-// Pop a value from the stack
-int stackPop(Stack* stack, HashMap** value) {
-    if (stackIsEmpty(stack)) {
-        return -1; // Stack underflow
+// Open a scope: just remember where its bindings will start
+void enterScope(ScopeTable* table) {
+    if (table->depth == table->markCapacity) {
+        table->markCapacity *= 2;
+        table->marks = (size_t*)realloc(table->marks, table->markCapacity * sizeof(size_t));
+        countResize(&table->mem, table->markCapacity / 2 * sizeof(size_t), table->markCapacity * sizeof(size_t));
     }
-    *value = stack->array[--stack->size];
-
-    // If the stack is less than a quarter full, resize it to half the size
-    if (stack->size <= stack->capacity / 4 && stack->capacity > 4) {
-        stackResize(stack, stack->capacity / 2);
-    }
-
-    return 0;
+    table->marks[table->depth++] = table->count;
 }
 
-// Peek at the top value of the stack without removing it
-int stackPeek(Stack* stack, HashMap** value) {
-    if (stackIsEmpty(stack)) {
-        return -1; // Stack is empty
+// Close the innermost scope, unwinding its bindings newest first
+void leaveScope(ScopeTable* table) {
+    size_t mark = table->marks[--table->depth];
+    while (table->count > mark) {
+        Binding* binding = &table->bindings[--table->count];
+        if (binding->shadowed == -1) {
+            removeHash(table->visible, binding->symbol);
+        } else {
+            insertHash(table->visible, binding->symbol, binding->shadowed);
+        }
     }
-    *value = stack->array[stack->size - 1];
-    return 0;
 }
 
-// Check if the stack is empty
-int stackIsEmpty(Stack* stack) {
-    return stack->size == 0;
+// Bind symbol in the innermost scope, hiding any outer binding
+void declareSymbol(ScopeTable* table, Symbol symbol, int value) {
+    int previous = getHash(table->visible, symbol);
+    if (table->count == table->capacity) {
+        table->capacity *= 2;
+        table->bindings = (Binding*)realloc(table->bindings, table->capacity * sizeof(Binding));
+        countResize(&table->mem, table->capacity / 2 * sizeof(Binding), table->capacity * sizeof(Binding));
+    }
+    Binding* binding = &table->bindings[table->count];
+    binding->symbol = symbol;
+    binding->value = value;
+    binding->depth = (int)table->depth;
+    binding->shadowed = previous;
+    insertHash(table->visible, symbol, (int)table->count++);
 }
 
-// Get the current size of the stack
-size_t stackSize(Stack* stack) {
-    return stack->size;
+// Whether the innermost scope already declares symbol
+int declaredInScope(ScopeTable* table, Symbol symbol) {
+    int index = getHash(table->visible, symbol);
+    return index != -1 && table->bindings[index].depth == (int)table->depth;
 }
 
-// Resize the stack's internal array to the new capacity
-void stackResize(Stack* stack, size_t newCapacity) {
-    stack->capacity = newCapacity;
-    stack->array = (HashMap**)realloc(stack->array, stack->capacity * sizeof(HashMap*));
+// Value of the innermost visible binding of symbol, -1 if there is none
+int lookupSymbol(ScopeTable* table, Symbol symbol) {
+    int index = getHash(table->visible, symbol);
+    return index == -1 ? -1 : table->bindings[index].value;
 }
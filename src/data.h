@@ -1,44 +1,139 @@
 #ifndef DATA_H
 #define DATA_H
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+// An interned string: a small, stable integer standing for its text.
+typedef int Symbol;
+#define NO_SYMBOL (-1)
+
+// Heap use of one structure, reported by --mem-stats: malloc/realloc
+// calls, the bytes they asked for in total (a realloc counts at its new
+// size), and the bytes still held.
+typedef struct {
+    size_t allocations;
+    size_t bytes;
+    size_t live;
+} MemCounter;
+
+static inline void countAlloc(MemCounter* counter, size_t bytes) {
+    counter->allocations++;
+    counter->bytes += bytes;
+    counter->live += bytes;
+}
+
+static inline void countResize(MemCounter* counter, size_t oldBytes, size_t newBytes) {
+    counter->allocations++;
+    counter->bytes += newBytes;
+    counter->live += newBytes - oldBytes;
+}
+
+static inline void countFree(MemCounter* counter, size_t bytes) {
+    counter->live -= bytes;
+}
+
+// A block of arena memory; data runs to the end of the allocation.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+// Bump allocator for objects that all die together (e.g. one AST).
+typedef struct {
+    ArenaBlock* head;       // Block currently being filled
+    size_t blockSize;
+    size_t allocations;     // Number of arenaAlloc calls
+    size_t bytes;           // Bytes handed out
+    MemCounter mem;         // The arena itself and its blocks
+} Arena;
+
+// A slot of the interner's index. The hash is kept next to the symbol so
+// a probe can skip mismatches, and the index can grow, without touching text.
+typedef struct {
+    Symbol symbol;          // NO_SYMBOL if empty
+    uint32_t hash;
+} InternSlot;
+
+// Maps each distinct string to one Symbol, and back.
+typedef struct {
+    char** strings;         // Symbol -> text
+    size_t count;
+    size_t capacity;
+    InternSlot* table;      // Open-addressed index of strings
+    size_t tableCapacity;   // A power of two
+    Arena* text;            // Owns the string copies
+    MemCounter mem;         // Interner, string and table arrays (not the arena)
+} Interner;
+
 // Define the structure for each entry in the HashMap
 typedef struct {
-    char* key;
+    Symbol key;             // NO_SYMBOL marks an empty slot
     int value;
 } HashMapEntry;
 
-// Define the structure for the HashMap
+// Robin Hood hash map: an entry sits at most as far from its home slot
+// as the entries it passed, so a miss stops early, and deletion shifts
+// the following entries back instead of leaving tombstones.
 typedef struct {
     size_t size;
-    size_t capacity;
+    size_t capacity;        // A power of two
+    unsigned shift;         // 32 - log2(capacity)
     HashMapEntry* entries;
+    MemCounter mem;         // The map and its entry array
 } HashMap;
 
-// Stack structure definition
+// One declaration in a ScopeTable.
 typedef struct {
-    HashMap** array;        
-    size_t size;      
-    size_t capacity;   
-} Stack;
+    Symbol symbol;
+    int value;
+    int depth;              // Scope depth it was declared at
+    int shadowed;           // Binding it hides, -1 if none
+} Binding;
+
+// Variables visible at a point in the program. One map gives each symbol
+// its innermost binding; bindings are logged in declaration order so
+// leaving a scope pops its own and restores whatever they shadowed.
+// Entering a scope and looking a name up are both O(1).
+typedef struct {
+    HashMap* visible;       // Symbol -> index of its innermost binding
+    Binding* bindings;
+    size_t count;
+    size_t capacity;
+    size_t* marks;          // Binding count when each open scope was entered
+    size_t depth;
+    size_t markCapacity;
+    MemCounter mem;         // Table, bindings and marks (not the map)
+} ScopeTable;
+
+// Arena:
+Arena* createArena(size_t blockSize);
+void freeArena(Arena* arena);
+void* arenaAlloc(Arena* arena, size_t size);
+char* arenaStrndup(Arena* arena, const char* text, size_t length);
+
+// Interner:
+Interner* createInterner();
+void freeInterner(Interner* interner);
+Symbol intern(Interner* interner, const char* text, size_t length);
+const char* symbolName(const Interner* interner, Symbol symbol);
 
 // Hashmap: 
 HashMap* createHashmap(size_t capacity);
 void freeHashmap(HashMap* hashmap);
-int getHash(HashMap* hashmap, const char* key);
-int insertHash(HashMap* hashmap, const char* key, int value);
-int removeHash(HashMap* hashmap, const char* key);
-int copyHashMap(HashMap* dest, const HashMap* src);
-
-// Stack:
-Stack* createStack();
-void freeStack(Stack* stack);
-int stackPush(Stack* stack, HashMap* value);
-int stackPop(Stack* stack, HashMap** value);
-int stackPeek(Stack* stack, HashMap** value);
-int stackIsEmpty(Stack* stack);
-size_t stackSize(Stack* stack);
-void stackResize(Stack* stack, size_t newCapacity);
+int getHash(HashMap* hashmap, Symbol key);
+int insertHash(HashMap* hashmap, Symbol key, int value);
+int removeHash(HashMap* hashmap, Symbol key);
+
+// Scopes:
+ScopeTable* createScopeTable();
+void freeScopeTable(ScopeTable* table);
+void enterScope(ScopeTable* table);
+void leaveScope(ScopeTable* table);
+void declareSymbol(ScopeTable* table, Symbol symbol, int value);
+int declaredInScope(ScopeTable* table, Symbol symbol);
+int lookupSymbol(ScopeTable* table, Symbol symbol);
 
 #endif
@@ -1,442 +1,452 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include "parser.h"
 #include "generator.h"
 #include "data.h"
 
-int labelCount = 0;
-HashMap *varmap, *localmap; 
-Stack* varmaps;
-int stackIndex = 0;
-int m;
-int cFail;
-int ret;
+void initCodeGenerator(CodeGenerator *gen, CompilerContext *ctx) {
+    initStringBuffer(&gen->sb);
+    gen->output = -1;
+    gen->assembler = NULL;
+    gen->ctx = ctx;
+    gen->ast = NULL;
+    gen->labelCount = 0;
+    initIRBuilder(&gen->ir, ctx, NULL);
+    initRegAllocator(&gen->regs);
+    gen->spillBase = 0;
+    gen->failed = 0;
+}
+
+void freeCodeGenerator(CodeGenerator *gen) {
+    free(gen->sb.data);
+    gen->sb.data = NULL;
+    freeIRBuilder(&gen->ir);
+    freeRegAllocator(&gen->regs);
+}
+
 void initStringBuffer(StringBuffer *sb) {
     sb->capacity = 256;
     sb->length = 0;
     sb->data = malloc(sb->capacity);
+    memset(&sb->mem, 0, sizeof(MemCounter));
+    countAlloc(&sb->mem, sb->capacity);
     sb->data[0] = '\0';
 }
 
-void appendString(StringBuffer *sb, const char *str) {
-    size_t addLen = strlen(str);
-    if (sb->length + addLen + 1 > sb->capacity) {
-        while (sb->length + addLen + 1 > sb->capacity) {
+// Make room for extra more bytes plus the terminating NUL.
+static void reserveString(StringBuffer *sb, size_t extra) {
+    if (sb->length + extra + 1 > sb->capacity) {
+        size_t oldCapacity = sb->capacity;
+        while (sb->length + extra + 1 > sb->capacity) {
             sb->capacity *= 2;
         }
         sb->data = realloc(sb->data, sb->capacity);
+        countResize(&sb->mem, oldCapacity, sb->capacity);
     }
-    strcat(sb->data, str);
-    sb->length += addLen;
 }
 
-void appendFormat(StringBuffer *sb, const char *format, ...) {
-    char temp[512];
-    va_list args;
-    va_start(args, format);
-    vsnprintf(temp, sizeof(temp), format, args);
-    va_end(args);
-    appendString(sb, temp);
+// Appends copy at the known end of the buffer, so emitting is linear in
+// the output size.
+void appendBytes(StringBuffer *sb, const char *bytes, size_t length) {
+    reserveString(sb, length);
+    memcpy(sb->data + sb->length, bytes, length);
+    sb->length += length;
+    sb->data[sb->length] = '\0';
+}
+
+void appendString(StringBuffer *sb, const char *str) {
+    appendBytes(sb, str, strlen(str));
 }
 
-void makeLabel(char *label, int id) {
-    labelCount++;
-    snprintf(label, 256, "_LLLL%d", id);
+void appendInt(StringBuffer *sb, int value) {
+    char digits[12];
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--p = '-';
+    }
+    appendBytes(sb, p, end - p);
 }
 
-int generateX86(CodeGenerator *gen, ASTNode *node) {
-    if (!node)
-        return 1;
+// Labels are numbered; the number is all that's kept until it's emitted.
+static void appendLabel(StringBuffer *sb, int label) {
+    appendBytes(sb, "_LLLL", 5);
+    appendInt(sb, label);
+}
 
-    switch (node->type) {
-        case AST_PROGRAM: {
-            varmaps = createStack();
-            for (int i = 0; i < node->program.functionCount; i++) {
-                generateX86(gen, node->program.functions[i]);
-            }
-            break;
-        }
-        case AST_FUNCTION: {
-            // Emit global directive and function label.
-            appendFormat(&gen->sb, "    .globl %s\n", node->function.name);
-            appendFormat(&gen->sb, "%s:\n", node->function.name);
-            appendFormat(&gen->sb, "    push     %%ebp\n");
-            appendFormat(&gen->sb, "    movl     %%esp, %%ebp\n");
-            generateX86(gen, node->function.body);
-            // Section 5.1.2.2.3, C11:
-            if (!(strcmp(node->function.name, "main")) && !(ret)) {
-                appendString(&gen->sb, "    movl     $0, %eax\n");
+static int streaming(const CodeGenerator *gen) {
+    return gen->output >= 0 || gen->assembler;
+}
+
+// Write out (or assemble) everything buffered so far and empty the
+// buffer, keeping its capacity for the next function.
+static void flushOutput(CodeGenerator *gen) {
+    if (gen->assembler) {
+        // Assembler failures aren't compile errors; the caller checks
+        // the assembler and falls back to an external one.
+        assembleText(gen->assembler, gen->sb.data, gen->sb.length);
+        gen->sb.length = 0;
+        gen->sb.data[0] = '\0';
+        return;
+    }
+    size_t written = 0;
+    while (written < gen->sb.length) {
+        ssize_t n = write(gen->output, gen->sb.data + written, gen->sb.length - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            appendFormat(&gen->sb, "    movl     %%ebp, %%esp\n");
-            appendFormat(&gen->sb, "    pop      %%ebp\n");
-            appendString(&gen->sb, "    ret\n");
+            perror("Failed to write assembly");
+            gen->failed = 1;
             break;
         }
-        case AST_BLOCK: {
-            // Create a new hashmap:
-            HashMap *h = createHashmap(64);
-            HashMap *l = createHashmap(64);
-            HashMap *temp;
-            int stackIndextemp = stackIndex;
-            
-            // Check top of stack:
-            if (stackPeek(varmaps, &temp) != -1) 
-                copyHashMap(h, temp);
-            stackPush(varmaps, h);
-            
-            // Set local:
-            localmap = l;
-            
-            // Process each statement in the block:
-            for (int i = 0; i < node->block.statementCount; i++) {
-                generateX86(gen, node->block.statements[i]);
-            }
-            
-            // Pop and free:
-            stackIndextemp -= stackIndex;
-            stackPop(varmaps, &temp);
-            freeHashmap(temp);
-            freeHashmap(l);
-            // freeHashmap(h);
-            char resetString[64];
-            snprintf(resetString, 64, "    addl     $%d, %%esp\n", stackIndextemp);
-            appendString(&gen->sb, resetString);
-            stackIndex += stackIndextemp;
-            break;
+        written += n;
+    }
+    gen->sb.length = 0;
+    gen->sb.data[0] = '\0';
+}
+
+// %eax is never allocated; it's the scratch register selection works in.
+#define SCRATCH (NO_VREG - 1)
+
+static const char *const registerNames[REG_COUNT] = {
+    [REG_ECX] = "%ecx", [REG_EDX] = "%edx", [REG_EBX] = "%ebx",
+    [REG_ESI] = "%esi", [REG_EDI] = "%edi",
+};
+
+static int inRegister(const CodeGenerator *gen, int32_t vreg) {
+    return vreg == SCRATCH || (gen->regs.location[vreg] >= 0 && gen->regs.location[vreg] < REG_COUNT);
+}
+
+static int inMemory(const CodeGenerator *gen, int32_t vreg) {
+    return vreg != SCRATCH && gen->regs.location[vreg] >= REG_COUNT;
+}
+
+static int isImmediate(const CodeGenerator *gen, int32_t vreg) {
+    return vreg != SCRATCH && gen->regs.location[vreg] == IMMEDIATE;
+}
+
+static int sameLocation(const CodeGenerator *gen, int32_t a, int32_t b) {
+    if (a == SCRATCH || b == SCRATCH || isImmediate(gen, a) || isImmediate(gen, b)) {
+        return a == b;
+    }
+    return gen->regs.location[a] == gen->regs.location[b];
+}
+
+// A vreg's register, its stack slot below the saved registers, or its
+// value if it's a constant.
+static void appendOperand(CodeGenerator *gen, int32_t vreg) {
+    StringBuffer *sb = &gen->sb;
+    if (vreg == SCRATCH) {
+        appendBytes(sb, "%eax", 4);
+    } else if (isImmediate(gen, vreg)) {
+        appendBytes(sb, "$", 1);
+        appendInt(sb, gen->regs.immediate[vreg]);
+    } else if (gen->regs.location[vreg] < REG_COUNT) {
+        appendBytes(sb, registerNames[gen->regs.location[vreg]], 4);
+    } else {
+        appendInt(sb, gen->spillBase - 4 * (SPILL_SLOT(gen->regs.location[vreg]) + 1));
+        appendBytes(sb, "(%ebp)", 6);
+    }
+}
+
+// mnemonic src, dst, e.g. "    addl     " v1 ", " v2 "\n".
+static void appendOp(CodeGenerator *gen, const char *mnemonic, int32_t src, int32_t dst) {
+    appendString(&gen->sb, mnemonic);
+    appendOperand(gen, src);
+    appendBytes(&gen->sb, ", ", 2);
+    appendOperand(gen, dst);
+    appendBytes(&gen->sb, "\n", 1);
+}
+
+// mnemonic operand, e.g. "    negl     " v "\n".
+static void appendUnary(CodeGenerator *gen, const char *mnemonic, int32_t operand) {
+    appendString(&gen->sb, mnemonic);
+    appendOperand(gen, operand);
+    appendBytes(&gen->sb, "\n", 1);
+}
+
+static void appendMove(CodeGenerator *gen, int32_t src, int32_t dst) {
+    if (sameLocation(gen, src, dst)) {
+        return;
+    }
+    if (inMemory(gen, src) && inMemory(gen, dst)) {
+        appendOp(gen, "    movl     ", src, SCRATCH);
+        src = SCRATCH;
+    }
+    appendOp(gen, "    movl     ", src, dst);
+}
+
+// Set the flags from comparing vreg with zero.
+static void appendTest(CodeGenerator *gen, int32_t vreg) {
+    if (isImmediate(gen, vreg)) {
+        appendMove(gen, vreg, SCRATCH);
+        vreg = SCRATCH;
+    }
+    if (inRegister(gen, vreg)) {
+        appendOp(gen, "    testl    ", vreg, vreg);
+    } else {
+        appendUnary(gen, "    cmpl     $0, ", vreg);
+    }
+}
+
+// Set the flags from a - b. The first operand of cmpl can't be a constant,
+// and only one of them can be in memory.
+static void appendCompare(CodeGenerator *gen, int32_t a, int32_t b) {
+    if (isImmediate(gen, a) || (inMemory(gen, a) && inMemory(gen, b))) {
+        appendMove(gen, a, SCRATCH);
+        a = SCRATCH;
+    }
+    appendOp(gen, "    cmpl     ", b, a);
+}
+
+static void appendJump(StringBuffer *sb, const char *jump, int label) {
+    appendString(sb, jump);
+    appendLabel(sb, label);
+    appendBytes(sb, "\n", 1);
+}
+
+// Instruction that combines the first operand with the second, for the
+// arithmetic operations.
+static const char *const arithmeticCode[] = {
+    [IR_ADD] = "    addl     ",
+    [IR_SUB] = "    subl     ",
+    [IR_MUL] = "    imull    ",
+};
+
+static const char *const setCode[] = {
+    [IR_LNOT] = "    sete     %al\n",
+    [IR_EQ] = "    sete     %al\n",
+    [IR_NE] = "    setne    %al\n",
+    [IR_LT] = "    setl     %al\n",
+    [IR_LE] = "    setle    %al\n",
+    [IR_GT] = "    setg     %al\n",
+    [IR_GE] = "    setge    %al\n",
+};
+
+// Conditional jumps for each comparison, taken when it's true and when
+// it's false.
+static const char *const branchCode[][2] = {
+    [IR_EQ] = { "    je       ", "    jne      " },
+    [IR_NE] = { "    jne      ", "    je       " },
+    [IR_LT] = { "    jl       ", "    jge      " },
+    [IR_LE] = { "    jle      ", "    jg       " },
+    [IR_GT] = { "    jg       ", "    jle      " },
+    [IR_GE] = { "    jge      ", "    jl       " },
+};
+
+// The jumps ending a block with branch, once the flags are set. jumps
+// holds the conditional jumps for when they mean true and false.
+static void appendBranch(CodeGenerator *gen, const char *const jumps[2], const IRInstr *branch,
+                         int labelBase, int32_t next) {
+    if (branch->imm == next) {
+        appendJump(&gen->sb, jumps[1], labelBase + branch->other);
+        return;
+    }
+    appendJump(&gen->sb, jumps[0], labelBase + branch->imm);
+    if (branch->other != next) {
+        appendJump(&gen->sb, "    jmp      ", labelBase + branch->other);
+    }
+}
+
+static void appendEpilogue(CodeGenerator *gen) {
+    StringBuffer *sb = &gen->sb;
+    int offset = 0;
+    for (int reg = 0; reg < REG_COUNT; reg++) {
+        if (gen->regs.usedRegisters & CALLEE_SAVED & (1u << reg)) {
+            offset -= 4;
+            appendString(sb, "    movl     ");
+            appendInt(sb, offset);
+            appendString(sb, "(%ebp), ");
+            appendString(sb, registerNames[reg]);
+            appendBytes(sb, "\n", 1);
         }
-        case AST_STATEMENT: {
-            appendString(&gen->sb, "    # statement\n");
-            if (node->statement.expression != NULL) {
-                generateX86(gen, node->statement.expression);  // Generate code for an expression.
-            }
-            if (node->statement.declaration != NULL) {
-                generateX86(gen, node->statement.declaration);  // Generate code for a declaration.
-            }
-            if (node->statement.retn != NULL) {
-                generateX86(gen, node->statement.retn); // Generate code for the return expression. 
+    }
+    appendString(sb, "    movl     %ebp, %esp\n");
+    appendString(sb, "    pop      %ebp\n");
+    appendString(sb, "    ret\n");
+}
+
+// Instruction selection: a short x86 sequence per IR instruction, over
+// the registers and stack slots the allocator picked. Results are built
+// in the destination's register when it has one, otherwise in %eax.
+static void selectInstr(CodeGenerator *gen, const IRInstr *instr, int labelBase, int32_t next) {
+    StringBuffer *sb = &gen->sb;
+    int32_t dst = instr->dst;
+    int32_t a = instr->a;
+    int32_t b = instr->b;
+    int32_t target = dst != NO_VREG && inRegister(gen, dst) ? dst : SCRATCH;
+    switch (instr->op) {
+        case IR_CONST:
+            if (isImmediate(gen, dst)) {
+                return; // Read straight from the instruction
             }
-            if (node->statement.ifstatement != NULL) {
-                generateX86(gen, node->statement.ifstatement); // Generate code for the if statement. 
+            if (instr->imm == 0 && inRegister(gen, dst)) {
+                appendOp(gen, "    xorl     ", dst, dst);
+            } else {
+                appendString(sb, "    movl     $");
+                appendInt(sb, instr->imm);
+                appendBytes(sb, ", ", 2);
+                appendOperand(gen, dst);
+                appendBytes(sb, "\n", 1);
             }
-            if (node->statement.compound != NULL) {
-                appendString(&gen->sb, "    # block start:\n");
-                generateX86(gen, node->statement.compound); 
-                appendString(&gen->sb, "    # block end.\n");
+            return;
+        case IR_COPY:
+            appendMove(gen, a, dst);
+            return;
+        case IR_JUMP:
+            if (instr->imm != next) {
+                appendJump(sb, "    jmp      ", labelBase + instr->imm);
             }
+            return;
+        case IR_BRANCH:
+            appendTest(gen, a);
+            appendBranch(gen, branchCode[IR_NE], instr, labelBase, next);
+            return;
+        case IR_RET:
+            appendMove(gen, a, SCRATCH);
+            appendEpilogue(gen);
+            return;
+        case IR_NEG:
+        case IR_NOT:
+            appendMove(gen, a, target);
+            appendUnary(gen, instr->op == IR_NEG ? "    negl     " : "    notl     ", target);
             break;
-        }
-        case AST_DECL: {
-            // Check existence:
-            if (stackIsEmpty(varmaps)) {
-                m = 1;
-            }
-            stackPeek(varmaps, &varmap);
-            const char *id = node->decl.identifier->identifier.value;
-            if (getHash(localmap, id) != -1) {
-                // TODO: make better compiler errors...
-                printf("Compile error: identifier already declared in this scope, at %s\n", id);
-                cFail = 1;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+            if (instr->op != IR_SUB && sameLocation(gen, b, target)) {
+                int32_t swap = a;
+                a = b;
+                b = swap;
             }
-            if (node->decl.initializer != NULL) {
-                generateX86(gen, node->decl.initializer);
+            if (sameLocation(gen, b, target) && !sameLocation(gen, a, target)) {
+                target = SCRATCH; // Loading a would overwrite b
             }
-            appendString(&gen->sb, "    pushl    %eax\n");
-            stackIndex -= 4;    
-            insertHash(varmap, id, stackIndex);
-            insertHash(localmap, id, stackIndex);
+            appendMove(gen, a, target);
+            appendOp(gen, arithmeticCode[instr->op], b, target);
             break;
-        }
-        case AST_RETURN: {
-            // Set a return flag:
-            ret = 1;
-            generateX86(gen, node->retn.expression);
-            appendFormat(&gen->sb, "    movl     %%ebp, %%esp\n");
-            appendFormat(&gen->sb, "    pop      %%ebp\n");
-            appendString(&gen->sb, "    movl     %eax, %eax\n");
-            appendString(&gen->sb, "    ret\n");
+        case IR_DIV:
+            // The allocator keeps anything live across this out of %edx.
+            target = SCRATCH;
+            appendMove(gen, a, SCRATCH);
+            appendString(sb, "    cdq\n");
+            appendUnary(gen, "    idivl    ", b);
             break;
-        }
-        case AST_IF: {
-            generateX86(gen, node->ifstmt.condition);
-            char label[256];
-            makeLabel(label, labelCount);
-            appendString(&gen->sb, "    cmpl     $0, %eax\n");
-            appendString(&gen->sb, "    je     ");
-            appendString(&gen->sb, label);
-            appendString(&gen->sb, "\n");
-            if (node->ifstmt.body->type == AST_STATEMENT 
-                && node->ifstmt.body->statement.declaration != NULL) {
-                printf("They decided this eons ago.\n");
-                cFail = 1;
-                return 1;
-            }
-            generateX86(gen, node->ifstmt.body);
-            char label2[256];
-            makeLabel(label2, labelCount);
-            appendString(&gen->sb, "    jmp     ");
-            appendString(&gen->sb, label2);
-            appendString(&gen->sb, "\n");
-            appendString(&gen->sb, label);
-            appendString(&gen->sb, ":\n");
-            generateX86(gen, node->ifstmt.elsestmt);
-            appendString(&gen->sb, label2);
-            appendString(&gen->sb, ":\n");      
+        case IR_LNOT:
+            appendTest(gen, a);
+            appendString(sb, setCode[instr->op]);
+            appendUnary(gen, "    movzbl   %al, ", target);
             break;
-        }
-        case AST_FACTOR: {
-            if (node->factor.factor != NULL) generateX86(gen, node->factor.factor); // Generate code for the subfactor
-            if (node->factor.expression != NULL) generateX86(gen, node->factor.expression);  // Generate code for a subexpression
-            if (node->factor.unary != NULL) generateX86(gen, node->factor.unary);  // Generate code for a unary operator 
-            if (node->factor.constant != NULL) generateX86(gen, node->factor.constant);  // Generate code for the constant
-            if (node->factor.identifier != NULL) generateX86(gen, node->factor.identifier);
-            break;
-        }
-        case AST_BINARY: {
-            /*
-                x86 code for a binary addition operation:
-                <CODE FOR e1 GOES HERE>
-                push %eax ; save value of e1 on the stack
-                <CODE FOR e2 GOES HERE>
-                pop %ecx ; pop e1 from the stack into ecx
-                addl %ecx, %eax ; add e1 to e2, save results in eax
-
-                x86 code for comparisons:
-                <CODE FOR e1 GOES HERE>
-                push   %eax          ; save value of e1 on the stack
-                <CODE FOR e2 GOES HERE>
-                pop    %ecx          ; pop e1 from the stack into ecx - e2 is already in eax
-                cmpl   %eax, %ecx    ;set ZF on if e1 == e2, set it off otherwise
-                movl   $0, %eax      ;zero out EAX (doesn't change FLAGS)
-                sete   %al           ;set AL register (the lower byte of EAX) to 1 iff ZF is on
-            */
-            if (!(strcmp(node->binary.value, "+"))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    addl      %ecx, %eax\n");
-            }
-            if (!(strcmp(node->binary.value, "-"))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    subl      %eax, %ecx\n");
-                appendString(&gen->sb, "    movl      %ecx, %eax\n");
-            }
-            if (!(strcmp(node->binary.value, "*"))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    imul      %ecx, %eax\n");
-            }
-            if (!(strcmp(node->binary.value, "/"))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    xorl      %ecx, %eax\n");
-                appendString(&gen->sb, "    xorl      %eax, %ecx\n");
-                appendString(&gen->sb, "    xorl      %ecx, %eax\n");
-                appendString(&gen->sb, "    cdq\n");
-                appendString(&gen->sb, "    idivl     %ecx\n");
-            }
-            if (!(strcmp(node->binary.value, "<="))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    cmpl      %eax, %ecx\n");
-                appendString(&gen->sb, "    movl      $0, %eax\n");
-                appendString(&gen->sb, "    setle     %al\n");
-            }
-            if (!(strcmp(node->binary.value, "<"))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    cmpl      %eax, %ecx\n");
-                appendString(&gen->sb, "    movl      $0, %eax\n");
-                appendString(&gen->sb, "    setl      %al\n");
-            }
-            if (!(strcmp(node->binary.value, ">="))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    cmpl      %eax, %ecx\n");
-                appendString(&gen->sb, "    movl      $0, %eax\n");
-                appendString(&gen->sb, "    setge     %al\n");
-            }
-            if (!(strcmp(node->binary.value, ">"))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    cmpl      %eax, %ecx\n");
-                appendString(&gen->sb, "    movl      $0, %eax\n");
-                appendString(&gen->sb, "    setg      %al\n");
-            }
-            if (!(strcmp(node->binary.value, "=="))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    cmpl      %eax, %ecx\n");
-                appendString(&gen->sb, "    movl      $0, %eax\n");
-                appendString(&gen->sb, "    sete      %al\n");
-            }
-            if (!(strcmp(node->binary.value, "!="))) {
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    push      %eax\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    pop       %ecx\n");
-                appendString(&gen->sb, "    cmpl      %eax, %ecx\n");
-                appendString(&gen->sb, "    movl      $0, %eax\n");
-                appendString(&gen->sb, "    setne     %al\n");
-            }
-            if (!(strcmp(node->binary.value, "&&"))) {
-                char label[256];
-                makeLabel(label, labelCount);
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    cmpl     $0, %eax\n");
-                appendString(&gen->sb, "    jne     ");
-                appendString(&gen->sb, label);
-                appendString(&gen->sb, "\n");
-                char label2[256];
-                makeLabel(label2, labelCount);
-                appendString(&gen->sb, "    jmp   ");
-                appendString(&gen->sb, label2);
-                appendString(&gen->sb, "\n");
-                appendString(&gen->sb, label);
-                appendString(&gen->sb, ":\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    cmpl     $0, %eax\n");
-                appendString(&gen->sb, "    movl     $0, %eax\n");
-                appendString(&gen->sb, "    setne    %al\n");
-                appendString(&gen->sb, label2);
-                appendString(&gen->sb, ":\n");
-            }
-            if (!(strcmp(node->binary.value, "||"))) {
-                labelCount++;
-                char label[256];
-                makeLabel(label, labelCount);
-                generateX86(gen, node->binary.left);
-                appendString(&gen->sb, "    cmpl     $0, %eax\n");
-                appendString(&gen->sb, "    je     ");
-                appendString(&gen->sb, label);
-                appendString(&gen->sb, "\n");
-                appendString(&gen->sb, "    movl     $1, %eax\n");
-                labelCount++;
-                char label2[256];
-                makeLabel(label2, labelCount);
-                appendString(&gen->sb, "    jmp    ");
-                appendString(&gen->sb, label2);
-                appendString(&gen->sb, "\n");
-                appendString(&gen->sb, label);
-                appendString(&gen->sb, ":\n");
-                generateX86(gen, node->binary.right);
-                appendString(&gen->sb, "    cmpl     $0, %eax\n");
-                appendString(&gen->sb, "    movl     $0, %eax\n");
-                appendString(&gen->sb, "    setne    %al\n");
-                appendString(&gen->sb, label2);
-                appendString(&gen->sb, ":\n");
-            }
-            if (!(strcmp(node->binary.value, "="))) {
-                generateX86(gen, node->binary.right);
-                struct ASTNode* l = node->binary.left;
-                if (l->type != AST_FACTOR) {
-                    printf("Compile error: expected variable, found expression.\n");
-                    cFail = 1;
-                    return 1;
-                }
-                if (l->factor.identifier == NULL) {
-                    printf("Compile error: invalid assignment; expected variable.\n");
-                    cFail = 1;
-                    return 1;
-                }
-                if (stackIsEmpty(varmaps)) {
-                    printf("Compile error: no identifiers exist yet.\n");
-                    cFail = 1;
-                    break;
-                }
-                stackPeek(varmaps, &varmap); // Get the most recent definition of the variable
-                const char *id = l->factor.identifier->identifier.value;
-                int varOffset = getHash(varmap, id);
-                if (varOffset == -1) {
-                    printf("Compile error: variable does not exist in this scope.\n");
-                    cFail = 1;
-                    break; 
-                }
-                char offset[32];
-                snprintf(offset, 32, "    movl     %%eax, %d(%%ebp)\n", varOffset);
-                appendString(&gen->sb, offset);
-            }
+        default:
+            appendCompare(gen, a, b);
+            appendString(sb, setCode[instr->op]);
+            appendUnary(gen, "    movzbl   %al, ", target);
             break;
+    }
+    appendMove(gen, target, dst);
+}
+
+static void selectFunction(CodeGenerator *gen, const IRFunction *func) {
+    StringBuffer *sb = &gen->sb;
+    const RegAllocator *regs = &gen->regs;
+    const char *name = symbolName(gen->ctx->interner, func->name);
+    appendString(sb, "    .globl ");
+    appendString(sb, name);
+    appendString(sb, "\n");
+    appendString(sb, name);
+    appendString(sb, ":\n");
+    appendString(sb, "    push     %ebp\n");
+    appendString(sb, "    movl     %esp, %ebp\n");
+    // Callee-saved registers go just below %ebp, where the epilogue
+    // reloads them from; spill slots come after.
+    gen->spillBase = 0;
+    for (int reg = 0; reg < REG_COUNT; reg++) {
+        if (regs->usedRegisters & CALLEE_SAVED & (1u << reg)) {
+            appendString(sb, "    push     ");
+            appendString(sb, registerNames[reg]);
+            appendBytes(sb, "\n", 1);
+            gen->spillBase -= 4;
         }
-        case AST_TERNARY: {
-            generateX86(gen, node->ternary.condition);
-            char label[256];
-            makeLabel(label, labelCount);
-            appendString(&gen->sb, "    cmpl     $0, %eax\n");
-            appendString(&gen->sb, "    je     ");
-            appendString(&gen->sb, label);
-            appendString(&gen->sb, "\n");
-            generateX86(gen, node->ternary.trueCond);
-            char label2[256];
-            makeLabel(label2, labelCount);
-            appendString(&gen->sb, "    jmp   ");
-            appendString(&gen->sb, label2);
-            appendString(&gen->sb, "\n");
-            appendString(&gen->sb, label);
-            appendString(&gen->sb, ":\n");
-            generateX86(gen, node->ternary.falseCond);
-            appendString(&gen->sb, label2);
-            appendString(&gen->sb, ":\n");
-            break;
+    }
+    if (regs->spillSlots) {
+        appendString(sb, "    subl     $");
+        appendInt(sb, 4 * regs->spillSlots);
+        appendString(sb, ", %esp\n");
+    }
+
+    int labelBase = gen->labelCount;
+    gen->labelCount += (int)func->blockCount;
+    for (size_t i = 0; i < func->layoutCount; i++) {
+        uint32_t b = func->layout[i];
+        const IRBlock *block = &func->blocks[b];
+        if (!regs->reachable[b]) {
+            continue;
         }
-        case AST_CONSTANT: {
-            appendFormat(&gen->sb, "    movl     $%s, %%eax\n", node->constant.value);
-            break;
+        if (b != 0) {
+            appendLabel(sb, labelBase + (int)b);
+            appendString(sb, ":\n");
         }
-        case AST_UNARY: {
-            if (strcmp(node->unary.value, "-") == 0) {
-                appendString(&gen->sb, "    neg %eax\n");
-            }
-            if (strcmp(node->unary.value, "~") == 0) {
-                appendString(&gen->sb, "    not %eax\n");
+        // The block laid out next, if any, is reached by falling through.
+        int32_t next = -1;
+        for (size_t j = i + 1; j < func->layoutCount; j++) {
+            uint32_t candidate = func->layout[j];
+            if (regs->reachable[candidate]) {
+                next = (int32_t)candidate;
+                break;
             }
-            if (strcmp(node->unary.value, "!") == 0) {
-                appendString(&gen->sb, "    cmpl $0, %eax\n");
-                appendString(&gen->sb, "    movl $0, %eax\n");
-                appendString(&gen->sb, "    sete %al\n");
-            }   
-            break;
         }
-        case AST_IDENTIFIER: { 
-            if (stackIsEmpty(varmaps)) {
-                printf("Error: no identifiers exist yet.\n");
-                cFail = 1;
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            // A comparison only the branch reads goes straight to the
+            // flags, without making a 0 or 1 first.
+            if (k + 2 == block->count && instr->op >= IR_EQ && instr->op <= IR_GE
+                && instr[1].op == IR_BRANCH && instr[1].a == instr->dst
+                && regs->globalIndex[instr->dst] < 0) {
+                appendCompare(gen, instr->a, instr->b);
+                appendBranch(gen, branchCode[instr->op], &instr[1], labelBase, next);
                 break;
             }
-            stackPeek(varmaps, &varmap); // Get the most recent definition of the thing
-            int varOffset = getHash(varmap, node->identifier.value);
-            if (varOffset == -1) {
-                printf("Compile error: identifier does not exist.\n");
-                cFail = 1;
-            }
-            char offset[32];
-            snprintf(offset, 32, "    movl      %d(%%ebp), %%eax\n", varOffset);
-            appendString(&gen->sb, offset);
-            break;
+            selectInstr(gen, instr, labelBase, next);
         }
-        default:
-            appendString(&gen->sb, "    # Unknown AST Node\n");
-            break;
     }
-    return cFail;
+}
+
+int generateX86(CodeGenerator *gen, const AST *ast) {
+    gen->ast = ast;
+    gen->ir.ast = ast;
+    const ASTNode *program = astNode(ast, ast->root);
+    for (uint32_t i = 0; i < program->program.count; i++) {
+        if (lowerFunction(&gen->ir, ast->lists[program->program.first + i]) != 0) {
+            gen->failed = 1;
+        }
+        if (gen->failed) {
+            continue; // Keep lowering for the error messages
+        }
+        propagateCopies(&gen->ir.func);
+        #ifdef DEBUG
+        if (verifyIR(&gen->ir.func, gen->ctx->interner, stderr) != 0) {
+            gen->failed = 1;
+            continue;
+        }
+        #endif
+        allocateRegisters(&gen->regs, &gen->ir.func);
+        selectFunction(gen, &gen->ir.func);
+        if (streaming(gen) && gen->sb.length >= OUTPUT_FLUSH_BYTES) {
+            flushOutput(gen);
+        }
+    }
+    if (streaming(gen) && !gen->failed) {
+        flushOutput(gen);
+    }
+    return gen->failed;
 }
@@ -1,19 +1,40 @@
 #include "parser.h"
+#include "data.h"
+#include "assembler.h"
+#include "ir.h"
+#include "regalloc.h"
 #ifndef GENERATOR_H 
 #define GENERATOR_H
 
+// When streaming, buffered asm is written out once a function ends with at
+// least this much pending, so the buffer holds at most about one function.
+#define OUTPUT_FLUSH_BYTES (64 * 1024)
+
 typedef struct {
     char *data;
     size_t length;
     size_t capacity;
+    MemCounter mem;
 } StringBuffer;
 
 typedef struct {
     StringBuffer sb; // Accumulates generated code.
+    int output;      // Descriptor the code is streamed to, or -1 to keep it all in sb.
+    Assembler *assembler; // If set, code is streamed here instead of to output.
+    CompilerContext *ctx; // Compile being generated; names come from its interner.
+    const AST *ast;  // Tree being generated.
+    int labelCount;  // Next free label number.
+    IRBuilder ir;    // Lowers each function before instructions are selected.
+    RegAllocator regs; // Where each of the function's vregs lives.
+    int spillBase;   // Offset from %ebp just above the first spill slot.
+    int failed;      // Set once a compile error has been reported.
 } CodeGenerator;
 
+void initCodeGenerator(CodeGenerator *gen, CompilerContext *ctx);
+void freeCodeGenerator(CodeGenerator *gen);
 void initStringBuffer(StringBuffer *sb);
+void appendBytes(StringBuffer *sb, const char *bytes, size_t length);
 void appendString(StringBuffer *sb, const char *str);
-void appendFormat(StringBuffer *sb, const char *format, ...);
-int generateX86(CodeGenerator *gen, ASTNode *node);
+void appendInt(StringBuffer *sb, int value);
+int generateX86(CodeGenerator *gen, const AST *ast);
 #endif
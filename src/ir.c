@@ -0,0 +1,774 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+
+static const char *const opNames[] = {
+    [IR_CONST] = "const", [IR_COPY] = "copy", [IR_NEG] = "neg", [IR_NOT] = "not",
+    [IR_LNOT] = "lnot", [IR_ADD] = "add", [IR_SUB] = "sub", [IR_MUL] = "mul",
+    [IR_DIV] = "div", [IR_EQ] = "eq", [IR_NE] = "ne", [IR_LT] = "lt", [IR_LE] = "le",
+    [IR_GT] = "gt", [IR_GE] = "ge", [IR_JUMP] = "jump", [IR_BRANCH] = "branch",
+    [IR_RET] = "ret",
+};
+
+// IR operation for each binary operator token that maps onto one.
+static const uint8_t binaryOps[TOKEN_INVALID + 1] = {
+    [OP_ADD] = IR_ADD, [OP_NEGATION] = IR_SUB, [OP_MUL] = IR_MUL, [OP_DIV] = IR_DIV,
+    [OP_EQ] = IR_EQ, [OP_NOTEQ] = IR_NE, [OP_LESS] = IR_LT, [OP_LESSEQ] = IR_LE,
+    [OP_GREATER] = IR_GT, [OP_GREATEREQ] = IR_GE,
+};
+
+static int isTerminator(uint8_t op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RET;
+}
+
+static int isBinary(uint8_t op) {
+    return op >= IR_ADD && op <= IR_GE;
+}
+
+// Grow array so it holds at least needed items.
+static void *reserveItems(void *array, size_t *capacity, size_t needed, size_t itemSize, MemCounter *mem) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    size_t oldCapacity = *capacity;
+    while (*capacity < needed) {
+        *capacity *= 2;
+    }
+    countResize(mem, oldCapacity * itemSize, *capacity * itemSize);
+    return realloc(array, *capacity * itemSize);
+}
+
+void initIRBuilder(IRBuilder *builder, CompilerContext *ctx, const AST *ast) {
+    memset(builder, 0, sizeof(IRBuilder));
+    builder->ctx = ctx;
+    builder->ast = ast;
+    builder->current = -1;
+    IRFunction *func = &builder->func;
+    func->codeCapacity = 256;
+    func->code = malloc(func->codeCapacity * sizeof(IRInstr));
+    func->blockCapacity = 32;
+    func->blocks = malloc(func->blockCapacity * sizeof(IRBlock));
+    func->layout = malloc(func->blockCapacity * sizeof(uint32_t));
+    func->predCapacity = 64;
+    func->preds = malloc(func->predCapacity * sizeof(uint32_t));
+    countAlloc(&builder->mem, func->codeCapacity * sizeof(IRInstr));
+    countAlloc(&builder->mem, func->blockCapacity * (sizeof(IRBlock) + sizeof(uint32_t)));
+    countAlloc(&builder->mem, func->predCapacity * sizeof(uint32_t));
+}
+
+void freeIRBuilder(IRBuilder *builder) {
+    free(builder->func.code);
+    free(builder->func.blocks);
+    free(builder->func.layout);
+    free(builder->func.preds);
+    freeScopeTable(builder->scopes);
+    memset(builder, 0, sizeof(IRBuilder));
+}
+
+static int32_t newVreg(IRBuilder *builder) {
+    return builder->func.vregCount++;
+}
+
+static int32_t newBlock(IRBuilder *builder) {
+    IRFunction *func = &builder->func;
+    if (func->blockCount == func->blockCapacity) {
+        size_t capacity = func->blockCapacity;
+        func->blocks = reserveItems(func->blocks, &func->blockCapacity, func->blockCount + 1,
+                                    sizeof(IRBlock), &builder->mem);
+        func->layout = reserveItems(func->layout, &capacity, func->blockCount + 1,
+                                    sizeof(uint32_t), &builder->mem);
+    }
+    memset(&func->blocks[func->blockCount], 0, sizeof(IRBlock));
+    return (int32_t)func->blockCount++;
+}
+
+// Start filling block; the previous one must already be terminated.
+static void openBlock(IRBuilder *builder, int32_t block) {
+    IRFunction *func = &builder->func;
+    func->blocks[block].first = (uint32_t)func->codeCount;
+    func->layout[func->layoutCount++] = (uint32_t)block;
+    builder->current = block;
+}
+
+static IRInstr *emit(IRBuilder *builder, IROp op, int32_t dst, int32_t a, int32_t b) {
+    if (builder->current < 0) {
+        // Code after a return: give it a block of its own, which nothing
+        // reaches.
+        openBlock(builder, newBlock(builder));
+    }
+    IRFunction *func = &builder->func;
+    func->code = reserveItems(func->code, &func->codeCapacity, func->codeCount + 1,
+                              sizeof(IRInstr), &builder->mem);
+    IRInstr *instr = &func->code[func->codeCount++];
+    instr->op = op;
+    instr->dst = dst;
+    instr->a = a;
+    instr->b = b;
+    instr->imm = 0;
+    instr->other = -1;
+    if (isTerminator(op)) {
+        IRBlock *block = &func->blocks[builder->current];
+        block->count = (uint32_t)func->codeCount - block->first;
+        builder->current = -1;
+    }
+    return instr;
+}
+
+static void emitJump(IRBuilder *builder, int32_t target) {
+    emit(builder, IR_JUMP, NO_VREG, NO_VREG, NO_VREG)->imm = target;
+}
+
+static void emitBranch(IRBuilder *builder, int32_t condition, int32_t target, int32_t other) {
+    IRInstr *instr = emit(builder, IR_BRANCH, NO_VREG, condition, NO_VREG);
+    instr->imm = target;
+    instr->other = other;
+}
+
+// Continue into block, falling through from the current one if it's open.
+static void startBlock(IRBuilder *builder, int32_t block) {
+    if (builder->current >= 0) {
+        emitJump(builder, block);
+    }
+    openBlock(builder, block);
+}
+
+static int32_t emitConst(IRBuilder *builder, int32_t value) {
+    int32_t dst = newVreg(builder);
+    emit(builder, IR_CONST, dst, NO_VREG, NO_VREG)->imm = value;
+    return dst;
+}
+
+static int32_t emitValue(IRBuilder *builder, IROp op, int32_t a, int32_t b) {
+    int32_t dst = newVreg(builder);
+    emit(builder, op, dst, a, b);
+    return dst;
+}
+
+static int32_t lowerExpression(IRBuilder *builder, NodeIndex index);
+
+// && and ||: the right operand is only evaluated if the left one doesn't
+// decide the result, which is always 0 or 1.
+static int32_t lowerLogical(IRBuilder *builder, const ASTNode *node) {
+    int32_t result = newVreg(builder);
+    int32_t right = newBlock(builder);
+    int32_t decided = newBlock(builder);
+    int32_t end = newBlock(builder);
+    int32_t left = lowerExpression(builder, node->binary.left);
+    if (node->binary.op == OP_AND) {
+        emitBranch(builder, left, right, decided);
+    } else {
+        emitBranch(builder, left, decided, right);
+    }
+    openBlock(builder, decided);
+    emit(builder, IR_CONST, result, NO_VREG, NO_VREG)->imm = node->binary.op == OP_OR;
+    emitJump(builder, end);
+    openBlock(builder, right);
+    int32_t value = lowerExpression(builder, node->binary.right);
+    emit(builder, IR_NE, result, value, emitConst(builder, 0));
+    startBlock(builder, end);
+    return result;
+}
+
+static int32_t lowerAssignment(IRBuilder *builder, const ASTNode *node) {
+    const AST *ast = builder->ast;
+    int32_t value = lowerExpression(builder, node->binary.right);
+    const ASTNode *l = astNode(ast, node->binary.left);
+    // ++x and x++ still name x.
+    if (l->type == AST_UNARY
+        && (l->unary.op == OP_INC || l->unary.op == OP_DEC)) {
+        l = astNode(ast, l->unary.operand);
+    }
+    if (l->type != AST_IDENTIFIER
+        && l->type != AST_CONSTANT
+        && l->type != AST_UNARY) {
+        printf("Compile error: expected variable, found expression.\n");
+        builder->failed = 1;
+        return value;
+    }
+    if (l->type != AST_IDENTIFIER) {
+        printf("Compile error: invalid assignment; expected variable.\n");
+        builder->failed = 1;
+        return value;
+    }
+    if (builder->scopes->depth == 0) {
+        printf("Compile error: no identifiers exist yet.\n");
+        builder->failed = 1;
+        return value;
+    }
+    int32_t var = lookupSymbol(builder->scopes, l->identifier.symbol); // The innermost definition
+    if (var == -1) {
+        printf("Compile error: variable does not exist in this scope.\n");
+        builder->failed = 1;
+        return value;
+    }
+    emit(builder, IR_COPY, var, value, NO_VREG);
+    return value;
+}
+
+// Lower an expression and return the vreg holding its value.
+static int32_t lowerExpression(IRBuilder *builder, NodeIndex index) {
+    const AST *ast = builder->ast;
+    const ASTNode *node = astNode(ast, index);
+    switch (node->type) {
+        case AST_CONSTANT: {
+            // Same readings of 0x and leading-0 octal as the assembler.
+            const char *text = symbolName(builder->ctx->interner, node->constant.value);
+            return emitConst(builder, (int32_t)(uint32_t)strtoll(text, NULL, 0));
+        }
+        case AST_IDENTIFIER: {
+            if (builder->scopes->depth == 0) {
+                printf("Error: no identifiers exist yet.\n");
+                builder->failed = 1;
+                return emitConst(builder, 0);
+            }
+            int32_t var = lookupSymbol(builder->scopes, node->identifier.symbol); // The innermost definition
+            if (var == -1) {
+                printf("Compile error: identifier does not exist.\n");
+                builder->failed = 1;
+                return emitConst(builder, 0);
+            }
+            // Read into a temporary: the variable may be assigned before
+            // this value is used, as in a + (a = 1).
+            return emitValue(builder, IR_COPY, var, NO_VREG);
+        }
+        case AST_UNARY: {
+            int32_t operand = lowerExpression(builder, node->unary.operand);
+            switch (node->unary.op) {
+                case OP_NEGATION:
+                    return emitValue(builder, IR_NEG, operand, NO_VREG);
+                case OP_COMPL:
+                    return emitValue(builder, IR_NOT, operand, NO_VREG);
+                case OP_NEGATIONL:
+                    return emitValue(builder, IR_LNOT, operand, NO_VREG);
+                default:
+                    return operand; // ++ and -- aren't implemented yet
+            }
+        }
+        case AST_BINARY: {
+            if (node->binary.op == OP_AND || node->binary.op == OP_OR) {
+                return lowerLogical(builder, node);
+            }
+            if (node->binary.op == OP_ASSN) {
+                return lowerAssignment(builder, node);
+            }
+            uint8_t op = binaryOps[node->binary.op];
+            if (!op) {
+                return emitConst(builder, 0); // += and -= aren't implemented yet
+            }
+            int32_t left = lowerExpression(builder, node->binary.left);
+            int32_t right = lowerExpression(builder, node->binary.right);
+            return emitValue(builder, op, left, right);
+        }
+        case AST_TERNARY: {
+            int32_t result = newVreg(builder);
+            int32_t whenTrue = newBlock(builder);
+            int32_t whenFalse = newBlock(builder);
+            int32_t end = newBlock(builder);
+            emitBranch(builder, lowerExpression(builder, node->ternary.condition), whenTrue, whenFalse);
+            openBlock(builder, whenTrue);
+            emit(builder, IR_COPY, result, lowerExpression(builder, node->ternary.trueCond), NO_VREG);
+            emitJump(builder, end);
+            openBlock(builder, whenFalse);
+            emit(builder, IR_COPY, result, lowerExpression(builder, node->ternary.falseCond), NO_VREG);
+            startBlock(builder, end);
+            return result;
+        }
+        default:
+            return emitConst(builder, 0);
+    }
+}
+
+static void lowerStatement(IRBuilder *builder, NodeIndex index);
+
+// The body of an if or for can't be a bare declaration.
+static int checkBody(IRBuilder *builder, NodeIndex body) {
+    if (body != NO_NODE && astNode(builder->ast, body)->type == AST_DECL) {
+        printf("They decided this eons ago.\n");
+        builder->failed = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static void lowerStatement(IRBuilder *builder, NodeIndex index) {
+    if (index == NO_NODE) {
+        return;
+    }
+    const AST *ast = builder->ast;
+    const ASTNode *node = astNode(ast, index);
+    switch (node->type) {
+        case AST_BLOCK: {
+            enterScope(builder->scopes);
+            for (uint32_t i = 0; i < node->block.count; i++) {
+                lowerStatement(builder, ast->lists[node->block.first + i]);
+            }
+            leaveScope(builder->scopes);
+            break;
+        }
+        case AST_DECL: {
+            Symbol id = node->decl.name;
+            if (declaredInScope(builder->scopes, id)) {
+                // TODO: make better compiler errors...
+                printf("Compile error: identifier already declared in this scope, at %s\n", symbolName(builder->ctx->interner, id));
+                builder->failed = 1;
+            }
+            // The initializer still sees any outer variable of the same name.
+            int32_t value = node->decl.initializer != NO_NODE
+                          ? lowerExpression(builder, node->decl.initializer)
+                          : emitConst(builder, 0);
+            int32_t var = newVreg(builder);
+            emit(builder, IR_COPY, var, value, NO_VREG);
+            declareSymbol(builder->scopes, id, var);
+            break;
+        }
+        case AST_RETURN: {
+            emit(builder, IR_RET, NO_VREG, lowerExpression(builder, node->retn.expression), NO_VREG);
+            break;
+        }
+        case AST_IF: {
+            int32_t condition = lowerExpression(builder, node->ifstmt.condition);
+            if (checkBody(builder, node->ifstmt.body)) {
+                return;
+            }
+            int32_t body = newBlock(builder);
+            int32_t end = newBlock(builder);
+            int32_t elseBlock = node->ifstmt.elsestmt != NO_NODE ? newBlock(builder) : end;
+            emitBranch(builder, condition, body, elseBlock);
+            openBlock(builder, body);
+            lowerStatement(builder, node->ifstmt.body);
+            if (elseBlock != end) {
+                if (builder->current >= 0) {
+                    emitJump(builder, end);
+                }
+                openBlock(builder, elseBlock);
+                lowerStatement(builder, node->ifstmt.elsestmt);
+            }
+            startBlock(builder, end);
+            break;
+        }
+        case AST_FOR: {
+            // init; head: if (!condition) goto end; body; post; goto head
+            const NodeIndex *parts = &ast->lists[node->forstmt.parts];
+            if (parts[0] != NO_NODE) {
+                lowerExpression(builder, parts[0]);
+            }
+            if (checkBody(builder, parts[3])) {
+                return;
+            }
+            int32_t head = newBlock(builder);
+            int32_t body = newBlock(builder);
+            int32_t end = newBlock(builder);
+            startBlock(builder, head);
+            if (parts[1] != NO_NODE) {
+                emitBranch(builder, lowerExpression(builder, parts[1]), body, end);
+            } else {
+                emitJump(builder, body);
+            }
+            openBlock(builder, body);
+            lowerStatement(builder, parts[3]);
+            if (parts[2] != NO_NODE) {
+                lowerExpression(builder, parts[2]);
+            }
+            emitJump(builder, head);
+            openBlock(builder, end);
+            break;
+        }
+        case AST_CONSTANT:
+        case AST_IDENTIFIER:
+        case AST_UNARY:
+        case AST_BINARY:
+        case AST_TERNARY:
+            lowerExpression(builder, index);
+            break;
+        default:
+            break;
+    }
+}
+
+// Fill in each block's predecessor list from the terminators.
+static void buildPredecessors(IRBuilder *builder) {
+    IRFunction *func = &builder->func;
+    size_t edges = 0;
+    for (size_t b = 0; b < func->blockCount; b++) {
+        func->blocks[b].predCount = 0;
+    }
+    for (size_t b = 0; b < func->blockCount; b++) {
+        int32_t succ[2];
+        blockSuccessors(func, (uint32_t)b, succ);
+        for (int i = 0; i < 2; i++) {
+            if (succ[i] >= 0) {
+                func->blocks[succ[i]].predCount++;
+                edges++;
+            }
+        }
+    }
+    func->preds = reserveItems(func->preds, &func->predCapacity, edges ? edges : 1,
+                               sizeof(uint32_t), &builder->mem);
+    uint32_t next = 0;
+    for (size_t b = 0; b < func->blockCount; b++) {
+        func->blocks[b].predFirst = next;
+        next += func->blocks[b].predCount;
+        func->blocks[b].predCount = 0;
+    }
+    for (size_t b = 0; b < func->blockCount; b++) {
+        int32_t succ[2];
+        blockSuccessors(func, (uint32_t)b, succ);
+        for (int i = 0; i < 2; i++) {
+            if (succ[i] >= 0) {
+                IRBlock *target = &func->blocks[succ[i]];
+                func->preds[target->predFirst + target->predCount++] = (uint32_t)b;
+            }
+        }
+    }
+}
+
+int lowerFunction(IRBuilder *builder, NodeIndex function) {
+    const ASTNode *node = astNode(builder->ast, function);
+    IRFunction *func = &builder->func;
+    func->name = node->function.name;
+    func->codeCount = 0;
+    func->blockCount = 0;
+    func->layoutCount = 0;
+    func->vregCount = 0;
+    builder->failed = 0;
+    if (!builder->scopes) {
+        builder->scopes = createScopeTable(); // Blocks are balanced, so it's empty again after each function
+    }
+
+    openBlock(builder, newBlock(builder));
+    lowerStatement(builder, node->function.body);
+    // Falling off the end returns 0; C11 5.1.2.2.3 requires it for main.
+    if (builder->current >= 0) {
+        emit(builder, IR_RET, NO_VREG, emitConst(builder, 0), NO_VREG);
+    }
+    buildPredecessors(builder);
+    return builder->failed;
+}
+
+const IRInstr *blockTerminator(const IRFunction *func, uint32_t block) {
+    const IRBlock *b = &func->blocks[block];
+    return b->count ? &func->code[b->first + b->count - 1] : NULL;
+}
+
+void blockSuccessors(const IRFunction *func, uint32_t block, int32_t succ[2]) {
+    const IRInstr *last = blockTerminator(func, block);
+    succ[0] = -1;
+    succ[1] = -1;
+    if (last && last->op == IR_JUMP) {
+        succ[0] = last->imm;
+    } else if (last && last->op == IR_BRANCH) {
+        succ[0] = last->imm;
+        succ[1] = last->other;
+    }
+}
+
+void propagateCopies(IRFunction *func) {
+    size_t n = func->vregCount ? (size_t)func->vregCount : 1;
+    int32_t *writes = calloc(n, sizeof(int32_t));
+    int32_t *reads = calloc(n, sizeof(int32_t));     // Reads not yet forwarded
+    int32_t *written = malloc(n * sizeof(int32_t));  // Block of the latest write seen
+    uint8_t *local = malloc(n);
+    uint8_t *forwarded = calloc(n, 1);
+    int32_t *source = malloc(n * sizeof(int32_t));   // What a temporary stands for, or -1
+    int32_t *copies = malloc(n * sizeof(int32_t));   // Temporaries standing for a vreg,
+    int32_t *nextCopy = malloc(n * sizeof(int32_t)); // linked through nextCopy
+    for (size_t v = 0; v < n; v++) {
+        written[v] = -1;
+        local[v] = 1;
+        source[v] = -1;
+        copies[v] = -1;
+    }
+
+    // A temporary is local if it's written once and only read after that
+    // in the same block. Nothing else sees it, so its reads can be redirected.
+    for (size_t b = 0; b < func->blockCount; b++) {
+        const IRBlock *block = &func->blocks[b];
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            int32_t operands[2] = { instr->a, instr->b };
+            for (int j = 0; j < 2; j++) {
+                if (operands[j] != NO_VREG) {
+                    reads[operands[j]]++;
+                    local[operands[j]] &= written[operands[j]] == (int32_t)b;
+                }
+            }
+            if (instr->dst != NO_VREG) {
+                writes[instr->dst]++;
+                written[instr->dst] = (int32_t)b;
+            }
+        }
+    }
+    for (size_t v = 0; v < n; v++) {
+        local[v] &= writes[v] == 1;
+    }
+
+    for (size_t b = 0; b < func->blockCount; b++) {
+        const IRBlock *block = &func->blocks[b];
+        for (uint32_t k = 0; k < block->count; k++) {
+            IRInstr *instr = &func->code[block->first + k];
+            int32_t *operands[2] = { &instr->a, &instr->b };
+            for (int j = 0; j < 2; j++) {
+                int32_t v = *operands[j];
+                if (v != NO_VREG && source[v] >= 0) {
+                    *operands[j] = source[v];
+                    reads[v]--;
+                    reads[source[v]]++;
+                }
+            }
+            int32_t dst = instr->dst;
+            if (dst == NO_VREG) {
+                continue;
+            }
+            // dst is changing, so anything that stood for it has to be
+            // read from its own copy from now on.
+            for (int32_t t = copies[dst]; t >= 0; t = nextCopy[t]) {
+                source[t] = -1;
+            }
+            copies[dst] = -1;
+            if (instr->op == IR_COPY && local[dst]) {
+                source[dst] = instr->a;
+                nextCopy[dst] = copies[instr->a];
+                copies[instr->a] = dst;
+                forwarded[dst] = 1;
+            }
+        }
+    }
+
+    // Drop the copies nothing reads any more, and fold "t = x op y; v = copy t"
+    // into "v = x op y" when that's the only read of t.
+    for (size_t b = 0; b < func->blockCount; b++) {
+        IRBlock *block = &func->blocks[b];
+        IRInstr *code = &func->code[block->first];
+        uint32_t kept = 0;
+        for (uint32_t k = 0; k < block->count; k++) {
+            IRInstr instr = code[k];
+            if (instr.op == IR_COPY && forwarded[instr.dst] && reads[instr.dst] == 0) {
+                reads[instr.a]--;
+                continue;
+            }
+            if (instr.op == IR_COPY && kept > 0 && code[kept - 1].dst == instr.a
+                && local[instr.a] && reads[instr.a] == 1) {
+                code[kept - 1].dst = instr.dst;
+                reads[instr.a] = 0;
+                continue;
+            }
+            code[kept++] = instr;
+        }
+        block->count = kept;
+    }
+    free(writes);
+    free(reads);
+    free(written);
+    free(local);
+    free(forwarded);
+    free(source);
+    free(copies);
+    free(nextCopy);
+}
+
+static int validVreg(const IRFunction *func, int32_t vreg) {
+    return vreg >= 0 && vreg < func->vregCount;
+}
+
+static int validBlock(const IRFunction *func, int32_t block) {
+    return block >= 0 && (size_t)block < func->blockCount;
+}
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+
+static int testBit(const unsigned long *set, int32_t bit) {
+    return (set[bit / BITS_PER_WORD] >> (bit % BITS_PER_WORD)) & 1;
+}
+
+static void setBit(unsigned long *set, int32_t bit) {
+    set[bit / BITS_PER_WORD] |= 1UL << (bit % BITS_PER_WORD);
+}
+
+int verifyIR(const IRFunction *func, const Interner *interner, FILE *out) {
+    const char *name = symbolName(interner, func->name);
+    int problems = 0;
+    #define PROBLEM(...) do { \
+        fprintf(out, "IR error in %s: ", name); \
+        fprintf(out, __VA_ARGS__); \
+        fprintf(out, "\n"); \
+        problems++; \
+    } while (0)
+
+    // Shape: every block is laid out once and ends in its only terminator,
+    // and every operand names a real vreg or block.
+    unsigned char *placed = calloc(func->blockCount ? func->blockCount : 1, 1);
+    for (size_t i = 0; i < func->layoutCount; i++) {
+        if (func->layout[i] >= func->blockCount || placed[func->layout[i]]++) {
+            PROBLEM("block %u laid out twice or doesn't exist", func->layout[i]);
+        }
+    }
+    if (func->blockCount == 0 || func->layoutCount == 0 || func->layout[0] != 0) {
+        PROBLEM("entry block b0 doesn't come first");
+    }
+    for (size_t b = 0; b < func->blockCount; b++) {
+        const IRBlock *block = &func->blocks[b];
+        if (!placed[b]) {
+            PROBLEM("b%zu is never laid out", b);
+        }
+        if (block->count == 0 || !isTerminator(blockTerminator(func, (uint32_t)b)->op)) {
+            PROBLEM("b%zu doesn't end in a terminator", b);
+        }
+        for (uint32_t i = 0; i < block->count; i++) {
+            const IRInstr *instr = &func->code[block->first + i];
+            uint8_t op = instr->op;
+            if (op > IR_RET) {
+                PROBLEM("b%zu: unknown operation %d", b, op);
+                continue;
+            }
+            if (isTerminator(op) && i + 1 < block->count) {
+                PROBLEM("b%zu: %s in the middle of the block", b, opNames[op]);
+            }
+            int hasDst = !isTerminator(op);
+            int hasA = op != IR_CONST && op != IR_JUMP;
+            if (hasDst != validVreg(func, instr->dst) || (!hasDst && instr->dst != NO_VREG)) {
+                PROBLEM("b%zu: %s has a bad destination v%d", b, opNames[op], instr->dst);
+            }
+            if (hasA != validVreg(func, instr->a)) {
+                PROBLEM("b%zu: %s has a bad operand v%d", b, opNames[op], instr->a);
+            }
+            if (isBinary(op) != validVreg(func, instr->b)) {
+                PROBLEM("b%zu: %s has a bad operand v%d", b, opNames[op], instr->b);
+            }
+            if ((op == IR_JUMP || op == IR_BRANCH) && !validBlock(func, instr->imm)) {
+                PROBLEM("b%zu: %s to missing block %d", b, opNames[op], instr->imm);
+            }
+            if (op == IR_BRANCH && !validBlock(func, instr->other)) {
+                PROBLEM("b%zu: branch to missing block %d", b, instr->other);
+            }
+        }
+    }
+    free(placed);
+    if (problems) {
+        return problems; // The checks below rely on the shape being right
+    }
+
+    // Predecessor lists match the edges.
+    size_t edges = 0;
+    for (size_t b = 0; b < func->blockCount; b++) {
+        int32_t succ[2];
+        blockSuccessors(func, (uint32_t)b, succ);
+        for (int i = 0; i < 2; i++) {
+            if (succ[i] < 0) {
+                continue;
+            }
+            edges++;
+            const IRBlock *target = &func->blocks[succ[i]];
+            int found = 0;
+            for (uint32_t p = 0; p < target->predCount; p++) {
+                found |= func->preds[target->predFirst + p] == b;
+            }
+            if (!found) {
+                PROBLEM("b%zu is missing predecessor b%zu", (size_t)succ[i], b);
+            }
+        }
+    }
+    size_t listed = 0;
+    for (size_t b = 0; b < func->blockCount; b++) {
+        listed += func->blocks[b].predCount;
+    }
+    if (listed != edges) {
+        PROBLEM("%zu predecessors listed for %zu edges", listed, edges);
+    }
+
+    // Every vreg is written on every path before it's read. defined[b] is
+    // the set written on entry to b, starting from "all" and narrowed to
+    // the intersection over predecessors until nothing changes. Blocks
+    // nothing reaches keep "all", so they're never reported.
+    size_t words = (func->vregCount + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    words = words ? words : 1;
+    unsigned long *defined = malloc(func->blockCount * words * sizeof(unsigned long));
+    unsigned long *work = malloc(words * sizeof(unsigned long));
+    memset(defined, 0xFF, func->blockCount * words * sizeof(unsigned long));
+    memset(defined, 0, words * sizeof(unsigned long));
+    for (int changed = 1; changed; ) {
+        changed = 0;
+        for (size_t i = 0; i < func->layoutCount; i++) {
+            uint32_t b = func->layout[i];
+            const IRBlock *block = &func->blocks[b];
+            memcpy(work, &defined[b * words], words * sizeof(unsigned long));
+            for (uint32_t k = 0; k < block->count; k++) {
+                int32_t dst = func->code[block->first + k].dst;
+                if (dst != NO_VREG) {
+                    setBit(work, dst);
+                }
+            }
+            int32_t succ[2];
+            blockSuccessors(func, b, succ);
+            for (int s = 0; s < 2; s++) {
+                if (succ[s] <= 0) {
+                    continue; // Nothing flows into the entry
+                }
+                unsigned long *in = &defined[succ[s] * words];
+                for (size_t w = 0; w < words; w++) {
+                    unsigned long narrowed = in[w] & work[w];
+                    changed |= narrowed != in[w];
+                    in[w] = narrowed;
+                }
+            }
+        }
+    }
+    for (size_t b = 0; b < func->blockCount; b++) {
+        const IRBlock *block = &func->blocks[b];
+        memcpy(work, &defined[b * words], words * sizeof(unsigned long));
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            if (instr->a != NO_VREG && !testBit(work, instr->a)) {
+                PROBLEM("b%zu: v%d read before it's written", b, instr->a);
+            }
+            if (instr->b != NO_VREG && !testBit(work, instr->b)) {
+                PROBLEM("b%zu: v%d read before it's written", b, instr->b);
+            }
+            if (instr->dst != NO_VREG) {
+                setBit(work, instr->dst);
+            }
+        }
+    }
+    free(defined);
+    free(work);
+    #undef PROBLEM
+    return problems;
+}
+
+void printIR(const IRFunction *func, const Interner *interner, FILE *out) {
+    fprintf(out, "function %s (%d vregs)\n", symbolName(interner, func->name), func->vregCount);
+    for (size_t i = 0; i < func->layoutCount; i++) {
+        uint32_t b = func->layout[i];
+        const IRBlock *block = &func->blocks[b];
+        fprintf(out, "b%u:", b);
+        for (uint32_t p = 0; p < block->predCount; p++) {
+            fprintf(out, "%s b%u", p ? "," : "    # preds", func->preds[block->predFirst + p]);
+        }
+        fprintf(out, "\n");
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            fprintf(out, "    ");
+            if (instr->dst != NO_VREG) {
+                fprintf(out, "v%d = ", instr->dst);
+            }
+            fprintf(out, "%s", opNames[instr->op]);
+            switch (instr->op) {
+                case IR_CONST:
+                    fprintf(out, " %d", instr->imm);
+                    break;
+                case IR_JUMP:
+                    fprintf(out, " b%d", instr->imm);
+                    break;
+                case IR_BRANCH:
+                    fprintf(out, " v%d, b%d, b%d", instr->a, instr->imm, instr->other);
+                    break;
+                default:
+                    fprintf(out, " v%d", instr->a);
+                    if (instr->b != NO_VREG) {
+                        fprintf(out, ", v%d", instr->b);
+                    }
+                    break;
+            }
+            fprintf(out, "\n");
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include "parser.h"
+#include "data.h"
+#ifndef IR_H
+#define IR_H
+
+// Three-address code between the AST and x86. Each function is a list of
+// basic blocks over an unbounded set of virtual registers (vregs). Every
+// variable and every intermediate value gets its own vreg; variables are
+// reassigned with IR_COPY, so this isn't SSA.
+typedef enum {
+    IR_CONST,   // dst = imm
+    IR_COPY,    // dst = a
+    IR_NEG,     // dst = -a
+    IR_NOT,     // dst = ~a
+    IR_LNOT,    // dst = !a
+    IR_ADD,     // dst = a + b
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_EQ,      // dst = a == b, and so on, each 0 or 1
+    IR_NE,
+    IR_LT,
+    IR_LE,
+    IR_GT,
+    IR_GE,
+    // Terminators: exactly one, at the end of every block.
+    IR_JUMP,    // goto target
+    IR_BRANCH,  // if (a) goto target else goto other
+    IR_RET,     // return a
+} IROp;
+
+#define NO_VREG (-1)
+
+typedef struct {
+    uint8_t op;         // IROp
+    int32_t dst;        // Result vreg, or NO_VREG
+    int32_t a, b;       // Operand vregs, or NO_VREG
+    int32_t imm;        // IR_CONST: the value; IR_JUMP, IR_BRANCH: target block
+    int32_t other;      // IR_BRANCH: block taken when a is zero
+} IRInstr;
+
+// Instructions code[first .. first + count). Every block is filled in one
+// go, so its instructions are contiguous.
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    uint32_t predFirst; // Predecessors are preds[predFirst .. + predCount)
+    uint32_t predCount;
+} IRBlock;
+
+typedef struct {
+    Symbol name;
+    IRInstr *code;
+    size_t codeCount, codeCapacity;
+    IRBlock *blocks;        // Block 0 is the entry
+    size_t blockCount, blockCapacity;
+    uint32_t *layout;       // Blocks in the order they were filled, for emission
+    size_t layoutCount;
+    uint32_t *preds;
+    size_t predCapacity;
+    int vregCount;
+} IRFunction;
+
+// Lowers one function at a time into func, reusing its arrays. Semantic
+// errors (undeclared or redeclared names and so on) are reported here.
+typedef struct {
+    CompilerContext *ctx;
+    const AST *ast;
+    IRFunction func;
+    ScopeTable *scopes;     // Variable -> vreg for the open blocks
+    int32_t current;        // Block being filled, or -1 after a terminator
+    int failed;             // Set once a compile error has been reported
+    MemCounter mem;
+} IRBuilder;
+
+void initIRBuilder(IRBuilder *builder, CompilerContext *ctx, const AST *ast);
+void freeIRBuilder(IRBuilder *builder);
+// Lower an AST_FUNCTION into builder->func. Returns nonzero if the
+// function has errors.
+int lowerFunction(IRBuilder *builder, NodeIndex function);
+// Instruction that ends a block, and the blocks it can go to (-1 if none).
+const IRInstr *blockTerminator(const IRFunction *func, uint32_t block);
+void blockSuccessors(const IRFunction *func, uint32_t block, int32_t succ[2]);
+// Read variables directly instead of through the temporaries lowering
+// copies them into, wherever the variable doesn't change before the
+// temporary is read, and drop the copies that leaves unused.
+void propagateCopies(IRFunction *func);
+// Check that func is well formed: terminators, targets, vreg numbers,
+// predecessor lists, and that no vreg is read before it's written on
+// every path. Problems are printed to out; returns the number found.
+int verifyIR(const IRFunction *func, const Interner *interner, FILE *out);
+void printIR(const IRFunction *func, const Interner *interner, FILE *out);
+#endif
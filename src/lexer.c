@@ -2,288 +2,429 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "lexer.h"
+#include "scan.h"
 
-int lineCount = 1;
-const char* keywords[] = {
-    "return",
-    "int",
-    "if",
-    "else",
-    "for",
-    "while",
-    "do",
-    "break",
-    "continue",
-    NULL
-};
-
-int isKeyword(const char* word) {
-    for (int i = 0; keywords[i] != NULL; i++) {
-        if (strcmp(word, keywords[i]) == 0) {
-            return 1; // It's a keyword
-        }
+// Map identifier text to its keyword token, or TOKEN_IDENTIFIER. Switching
+// on length and first character leaves at most one memcmp per identifier.
+// To add a keyword, add a KEYWORD line under its length and first letter.
+#define KEYWORD(word, token) \
+    if (memcmp(s, word, sizeof(word) - 1) == 0) return token
+
+static TokenType keywordType(const char* s, size_t len) {
+    switch (len) {
+        case 2:
+            switch (s[0]) {
+                case 'd': KEYWORD("do", KEYW_DO); break;
+                case 'i': KEYWORD("if", KEYW_IF); break;
+            }
+            break;
+        case 3:
+            switch (s[0]) {
+                case 'f': KEYWORD("for", KEYW_FOR); break;
+                case 'i': KEYWORD("int", KEYW_INT); break;
+            }
+            break;
+        case 4:
+            switch (s[0]) {
+                case 'e': KEYWORD("else", KEYW_ELSE); break;
+            }
+            break;
+        case 5:
+            switch (s[0]) {
+                case 'b': KEYWORD("break", KEYW_BREAK); break;
+                case 'w': KEYWORD("while", KEYW_WHILE); break;
+            }
+            break;
+        case 6:
+            switch (s[0]) {
+                case 'r': KEYWORD("return", KEYW_RETURN); break;
+            }
+            break;
+        case 8:
+            switch (s[0]) {
+                case 'c': KEYWORD("continue", KEYW_CONT); break;
+            }
+            break;
     }
-    return 0; // Not a keyword
+    return TOKEN_IDENTIFIER;
 }
 
-Lexer* createLexer(const char* input){
+#undef KEYWORD
+
+Lexer* createLexer(const char* input, size_t length, Interner* interner){
     Lexer* l = malloc(sizeof(Lexer));
     l->input = input;
+    l->interner = interner;
+    l->length = length;
     l->pos = 0;
+    l->line = 1;
+    l->tokenCount = 0;
     return l;   
 }
 
-Token* createToken(TokenType type, char* value){
-    Token* t = malloc(sizeof(Token));
-    t->type = type;
-    t->value = value;
-    t->line = lineCount;
-    return t;
-}
-
-void freeToken(Token* token){
-    free(token->value);
-    free(token);
+static int makeToken(Lexer* l, Token* out, TokenType type, size_t offset, size_t length){
+    out->type = type;
+    out->offset = offset;
+    out->length = length;
+    out->symbol = NO_SYMBOL;
+    out->line = l->line;
+    l->tokenCount++;
+    return 1;
 }
 
-// Main lexing logic:
-Token* lexerNextToken(Lexer* l) {
-    while(l->pos < strlen(l->input)){
+// Main lexing logic: scans the next token into *out, returns 0 at end of input.
+int lexerNextToken(Lexer* l, Token* out) {
+    while(l->pos < l->length){
         char c = l->input[l->pos];
+        size_t s = l->pos;
 
-        // Newline:
-        if (c == '\n') {
-            lineCount += 1;
-            l->pos++;
-            continue;
-        }
-
-        // Spaces, newlines, tabs:
+        // Spaces, newlines, tabs (the whole run at once):
         if (isspace(c)) {
-            l->pos++;
+            l->pos = scanSpace(l->input, l->pos, l->length, &l->line);
             continue;   
         }
 
         // Integer literal:
         if (isdigit(c)) {
-            size_t s = l->pos;
-            while(l->pos < strlen(l->input) && isdigit(l->input[l->pos])) {
-                l->pos++;
+            l->pos = scanDigits(l->input, l->pos, l->length);
+            makeToken(l, out, LITERAL_INT, s, l->pos - s);
+            if (l->interner) {
+                out->symbol = intern(l->interner, l->input + s, l->pos - s);
             }
-            char* n = strndup(l->input + s, l->pos - s);
-            return createToken(LITERAL_INT, n);
+            return 1;
         }
 
         // Parantheses:
         if (c == '(') {
             l->pos++;
-            return createToken(TOKEN_OPAREN, "(");
+            return makeToken(l, out, TOKEN_OPAREN, s, l->pos - s);
         }
         if (c == ')') {
             l->pos++;
-            return createToken(TOKEN_CPAREN, ")");
+            return makeToken(l, out, TOKEN_CPAREN, s, l->pos - s);
         }
 
         // Braces:
         if (c == '{') {
             l->pos++;
-            return createToken(TOKEN_OBRACE, "{");
+            return makeToken(l, out, TOKEN_OBRACE, s, l->pos - s);
         }
         if (c == '}') {
             l->pos++;
-            return createToken(TOKEN_CBRACE, "}");
+            return makeToken(l, out, TOKEN_CBRACE, s, l->pos - s);
         }
 
         // Semicolon:
         if (c == ';') {
             l->pos++;
-            return createToken(TOKEN_SEMICOL, ";");
+            return makeToken(l, out, TOKEN_SEMICOL, s, l->pos - s);
         }
 
         // Negation, Bitwise comp.:
         if (c == '-') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '=') {
+            if (l->pos < l->length && l->input[l->pos] == '=') {
                 l->pos++;
-                return createToken(OP_DECEQ, "-=");
+                return makeToken(l, out, OP_DECEQ, s, l->pos - s);
             }
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '-') {
+            if (l->pos < l->length && l->input[l->pos] == '-') {
                 l->pos++;
-                return createToken(OP_DEC, "--");
+                return makeToken(l, out, OP_DEC, s, l->pos - s);
             }
-            return createToken(OP_NEGATION, "-");
+            return makeToken(l, out, OP_NEGATION, s, l->pos - s);
         }
         if (c == '~') {
             l->pos++;
-            return createToken(OP_COMPL, "~");
+            return makeToken(l, out, OP_COMPL, s, l->pos - s);
         }
         if (c == '!') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '=') {
+            if (l->pos < l->length && l->input[l->pos] == '=') {
                 l->pos++;
-                return createToken(OP_NOTEQ, "!=");
+                return makeToken(l, out, OP_NOTEQ, s, l->pos - s);
             }
-            return createToken(OP_NEGATIONL, "!");
+            return makeToken(l, out, OP_NEGATIONL, s, l->pos - s);
         }
 
         // Operators:
         if (c == '+') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '=') {
+            if (l->pos < l->length && l->input[l->pos] == '=') {
                 l->pos++;
-                return createToken(OP_INCEQ, "+=");
+                return makeToken(l, out, OP_INCEQ, s, l->pos - s);
             }
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '+') {
+            if (l->pos < l->length && l->input[l->pos] == '+') {
                 l->pos++;
-                return createToken(OP_INC, "++");
+                return makeToken(l, out, OP_INC, s, l->pos - s);
             }
-            return createToken(OP_ADD, "+");
+            return makeToken(l, out, OP_ADD, s, l->pos - s);
         }
         if (c == '*') {
             l->pos++;
-            return createToken(OP_MUL, "*");
+            return makeToken(l, out, OP_MUL, s, l->pos - s);
         }
         if (c == '/') {
             l->pos++;
-            return createToken(OP_DIV, "/");
+            return makeToken(l, out, OP_DIV, s, l->pos - s);
         }
 
         // Logical operators:
         if (c == '=') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '=') {
+            if (l->pos < l->length && l->input[l->pos] == '=') {
                 l->pos++;
-                return createToken(OP_EQ, "==");
+                return makeToken(l, out, OP_EQ, s, l->pos - s);
             }
-            return createToken(OP_ASSN, "=");
+            return makeToken(l, out, OP_ASSN, s, l->pos - s);
         }
         if (c == '&') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '&') {
+            if (l->pos < l->length && l->input[l->pos] == '&') {
                 l->pos++;
-                return createToken(OP_AND, "&&");
+                return makeToken(l, out, OP_AND, s, l->pos - s);
             }
         }
         if (c == '|') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '|') {
+            if (l->pos < l->length && l->input[l->pos] == '|') {
                 l->pos++;
-                return createToken(OP_OR, "||");
+                return makeToken(l, out, OP_OR, s, l->pos - s);
             }
         }
         if (c == '<') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '=') {
+            if (l->pos < l->length && l->input[l->pos] == '=') {
                 l->pos++;
-                return createToken(OP_LESSEQ, "<=");
+                return makeToken(l, out, OP_LESSEQ, s, l->pos - s);
             }
-            return createToken(OP_LESS, "<");
+            return makeToken(l, out, OP_LESS, s, l->pos - s);
         }
         if (c == '>') {
             l->pos++;
-            if (l->pos < strlen(l->input) && l->input[l->pos] == '=') {
+            if (l->pos < l->length && l->input[l->pos] == '=') {
                 l->pos++;
-                return createToken(OP_GREATEREQ, ">=");
+                return makeToken(l, out, OP_GREATEREQ, s, l->pos - s);
             }
-            return createToken(OP_GREATER, ">");
+            return makeToken(l, out, OP_GREATER, s, l->pos - s);
         }
 
         // Conditional operator:
         if (c == '?') {
             l->pos++;
-            return createToken(OP_Q, "?");
+            return makeToken(l, out, OP_Q, s, l->pos - s);
         }
         if (c == ':') {
             l->pos++;
-            return createToken(OP_COLON, ":");
+            return makeToken(l, out, OP_COLON, s, l->pos - s);
         }
 
         // Identifier/Keyword:
         if (isalnum(c)) {
-            size_t s = l->pos;
-            while ( (l->pos < strlen(l->input)) 
-                    && isalnum(l->input[l->pos]) ) {
-                l->pos++;
+            l->pos = scanAlnum(l->input, l->pos, l->length);
+            size_t len = l->pos - s;
+            makeToken(l, out, keywordType(l->input + s, len), s, len);
+            if (out->type == TOKEN_IDENTIFIER && l->interner) {
+                out->symbol = intern(l->interner, l->input + s, len);
             }
-            char* str = strndup(l->input + s, l->pos - s);
-            if (isKeyword(str)){
-                if (strcmp(str, "int") == 0) {
-                    return createToken(KEYW_INT, str);
-                }
-                if (strcmp(str, "return") == 0) {
-                    return createToken(KEYW_RETURN, str);
-                }
-                if (strcmp(str, "if") == 0) {
-                    return createToken(KEYW_IF, str);
-                }
-                if (strcmp(str, "else") == 0) {
-                    return createToken(KEYW_ELSE, str);
-                }
-                if (strcmp(str, "for") == 0) {
-                    return createToken(KEYW_FOR, str);
-                }
-                if (strcmp(str, "while") == 0) {
-                    return createToken(KEYW_WHILE, str);
-                }
-                if (strcmp(str, "do") == 0) {
-                    return createToken(KEYW_DO, str);
-                }
-                if (strcmp(str, "break") == 0) {
-                    return createToken(KEYW_BREAK, str);
-                }
-                if (strcmp(str, "continue") == 0) {
-                    return createToken(KEYW_CONT, str);
-                }
-            }
-            return createToken(TOKEN_IDENTIFIER, str);
+            return 1;
         }
 
         l->pos++;
-        return createToken(TOKEN_INVALID, "Invalid");
+        return makeToken(l, out, TOKEN_INVALID, s, l->pos - s);
     }
-    return NULL;
+    return 0;
 }
 
-Token** lex(const char* filename, int* token_count) {
-    // Open the file
-    FILE* file = fopen(filename, "r");
-    if (!file) {
+// Map the file read-only when possible; pipes and other non-regular
+// files fall back to reading into a heap buffer.
+Source* openSource(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         perror("Could not open file");
         return NULL;
     }
 
-    fseek(file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    char* input = malloc(length + 1);
-    fread(input, 1, length, file);
-    input[length] = '\0'; // Null-terminate the string
-    fclose(file);
+    Source* source = malloc(sizeof(Source));
+    source->data = NULL;
+    source->length = 0;
+    source->mapped = 0;
+    memset(&source->mem, 0, sizeof(MemCounter));
+    countAlloc(&source->mem, sizeof(Source));
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            source->data = data;
+            source->length = st.st_size;
+            source->mapped = 1;
+            close(fd);
+            return source;
+        }
+    }
+
+    size_t capacity = 4096;
+    char* buffer = malloc(capacity);
+    countAlloc(&source->mem, capacity);
+    ssize_t n;
+    while ((n = read(fd, buffer + source->length, capacity - source->length)) > 0) {
+        source->length += n;
+        if (source->length == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            countResize(&source->mem, capacity / 2, capacity);
+        }
+    }
+    close(fd);
+    if (n < 0) {
+        perror("Could not read file");
+        free(buffer);
+        free(source);
+        return NULL;
+    }
+    source->data = buffer;
+    return source;
+}
+
+void closeSource(Source* source) {
+    if (!source) {
+        return;
+    }
+    if (source->mapped) {
+        munmap((void*)source->data, source->length);
+    } else {
+        free((void*)source->data);
+    }
+    free(source);
+}
+
+// Spelling of operator tokens, for printing.
+const char* tokenText(TokenType type) {
+    static const char* const text[] = {
+        [OP_NEGATION] = "-",   [OP_COMPL] = "~",      [OP_NEGATIONL] = "!",
+        [OP_ADD] = "+",        [OP_MUL] = "*",        [OP_DIV] = "/",
+        [OP_EQ] = "==",        [OP_AND] = "&&",       [OP_OR] = "||",
+        [OP_NOTEQ] = "!=",     [OP_LESS] = "<",       [OP_LESSEQ] = "<=",
+        [OP_GREATER] = ">",    [OP_GREATEREQ] = ">=", [OP_ASSN] = "=",
+        [OP_COLON] = ":",      [OP_Q] = "?",          [OP_INC] = "++",
+        [OP_DEC] = "--",       [OP_DECEQ] = "-=",     [OP_INCEQ] = "+=",
+    };
+    if (type < sizeof(text) / sizeof(text[0]) && text[type]) {
+        return text[type];
+    }
+    return "?";
+}
+
+static void tokenBufferGrow(TokenBuffer* tokens) {
+    size_t oldCapacity = tokens->capacity;
+    tokens->capacity = tokens->capacity ? tokens->capacity * 2 : 1024;
+    tokens->types = realloc(tokens->types, tokens->capacity * sizeof(*tokens->types));
+    tokens->offsets = realloc(tokens->offsets, tokens->capacity * sizeof(*tokens->offsets));
+    tokens->lengths = realloc(tokens->lengths, tokens->capacity * sizeof(*tokens->lengths));
+    tokens->symbols = realloc(tokens->symbols, tokens->capacity * sizeof(*tokens->symbols));
+    tokens->lines = realloc(tokens->lines, tokens->capacity * sizeof(*tokens->lines));
+    size_t perToken = sizeof(*tokens->types) + sizeof(*tokens->offsets) + sizeof(*tokens->lengths)
+                    + sizeof(*tokens->symbols) + sizeof(*tokens->lines);
+    countResize(&tokens->mem, oldCapacity * perToken, tokens->capacity * perToken);
+    tokens->mem.allocations += 4; // One per field array
+}
+
+TokenBuffer* lex(Source* source, Interner* interner) {
+    if (source->length > UINT32_MAX) {
+        fprintf(stderr, "Source file too large\n");
+        return NULL;
+    }
 
     // Create the lexer
-    Lexer* lexer = createLexer(input);
-    Token** tokens = NULL; // Start with a NULL pointer
-    *token_count = 0;
+    Lexer* lexer = createLexer(source->data, source->length, interner);
+    TokenBuffer* tokens = calloc(1, sizeof(TokenBuffer));
+    countAlloc(&tokens->mem, sizeof(TokenBuffer));
 
     // Tokenize the input
-    Token* token;
-    do {
-        token = lexerNextToken(lexer);
-        if (!token) {
-            break;
+    Token t;
+    while (lexerNextToken(lexer, &t)) {
+        if (tokens->count == tokens->capacity) {
+            tokenBufferGrow(tokens);
         }
-        // Append the token to the array
-        tokens = realloc(tokens, sizeof(Token*) * (*token_count + 1)); // Resize to hold one more token
-        tokens[*token_count] = token; // Add the new token
-        //printf("Current token: Type=%d, Value='%s'\n", tokens[*token_count]->type, tokens[*token_count]->value);
-        //printf("Current token index: %d\n", *token_count);
-        (*token_count)++;
-    } while (token != NULL); 
-
-    //free(token); // Free the last EOF token
+        int i = tokens->count++;
+        tokens->types[i] = t.type;
+        tokens->offsets[i] = t.offset;
+        tokens->lengths[i] = t.length;
+        tokens->symbols[i] = t.symbol;
+        tokens->lines[i] = t.line;
+    }
+
     free(lexer);
-    free(input); // Free the input string
 
-    return tokens; // Return the array of tokens
+    return tokens;
+}
+
+void freeTokenBuffer(TokenBuffer* tokens) {
+    if (tokens) {
+        free(tokens->types);
+        free(tokens->offsets);
+        free(tokens->lengths);
+        free(tokens->symbols);
+        free(tokens->lines);
+        free(tokens);
+    }
+}
+
+Token tokenAt(const TokenBuffer* tokens, int index) {
+    Token t;
+    t.type = tokens->types[index];
+    t.offset = tokens->offsets[index];
+    t.length = tokens->lengths[index];
+    t.symbol = tokens->symbols[index];
+    t.line = tokens->lines[index];
+    return t;
+}
+
+TokenStream* createTokenStream(Source* source, Interner* interner) {
+    TokenStream* stream = malloc(sizeof(TokenStream));
+    stream->lexer = createLexer(source->data, source->length, interner);
+    stream->head = 0;
+    stream->count = 0;
+    memset(&stream->mem, 0, sizeof(MemCounter));
+    countAlloc(&stream->mem, sizeof(TokenStream));
+    countAlloc(&stream->mem, sizeof(Lexer));
+    return stream;
+}
+
+void freeTokenStream(TokenStream* stream) {
+    if (stream) {
+        free(stream->lexer);
+        free(stream);
+    }
+}
+
+// Look k tokens ahead, lexing more input only as needed. Past the end of
+// the input the window is padded with EOF tokens.
+Token* streamPeek(TokenStream* stream, size_t k) {
+    while (stream->count <= k) {
+        Token* slot = &stream->window[(stream->head + stream->count) % TOKEN_LOOKAHEAD];
+        if (!lexerNextToken(stream->lexer, slot)) {
+            slot->type = TOKEN_EOF;
+            slot->offset = stream->lexer->length;
+            slot->length = 0;
+            slot->symbol = NO_SYMBOL;
+            slot->line = 0;
+        }
+        stream->count++;
+    }
+    return &stream->window[(stream->head + k) % TOKEN_LOOKAHEAD];
+}
+
+void streamAdvance(TokenStream* stream) {
+    if (stream->count == 0) {
+        streamPeek(stream, 0);
+    }
+    stream->head = (stream->head + 1) % TOKEN_LOOKAHEAD;
+    stream->count--;
 }
@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include "data.h"
 #ifndef LEXER_H
 #define LEXER_H
 typedef enum{
@@ -43,19 +45,68 @@ typedef enum{
     TOKEN_INVALID,
 } TokenType;
 
+// Tokens are slices into the source buffer; the text is never copied.
 typedef struct{
     TokenType type;
-    char* value;
+    size_t offset;  // Start of the token text in the source
+    size_t length;  // Length of the token text
+    Symbol symbol;  // Interned text of identifiers and literals, NO_SYMBOL otherwise
     int line;
 } Token;
 
+// Source text of one translation unit, kept alive for the whole compile.
+typedef struct{
+    const char *data;
+    size_t length;
+    int mapped;     // 1 if data is an mmap()ed view of the file
+    MemCounter mem; // This struct, plus a heap copy of the text if it wasn't mapped
+} Source;
+
 typedef struct{
     size_t pos;
+    int line;      // Line of the character at pos
+    size_t length; // Input size, so scanning never has to strlen()
     const char *input;
+    Interner *interner; // Identifiers and literals are interned here as they are lexed
+    size_t tokenCount; // Tokens produced so far
 } Lexer;
 
-Lexer* createLexer(const char* input);
-Token* createToken(TokenType type, char* value);
-void freeToken(Token* token);
-Token** lex(const char* filename, int* token_count);
+// Every token of a file in struct-of-arrays form: one contiguous array
+// per field, indexed by token number and grown geometrically.
+typedef struct{
+    unsigned char *types;   // TokenType of each token
+    uint32_t *offsets;      // Start of the token text in the source
+    uint32_t *lengths;      // Length of the token text
+    Symbol *symbols;        // Interned identifier or literal, NO_SYMBOL otherwise
+    int *lines;
+    int count;
+    int capacity;
+    MemCounter mem;
+} TokenBuffer;
+
+// Number of tokens a TokenStream can look ahead; a power of two.
+#define TOKEN_LOOKAHEAD 4
+
+// Pulls tokens from the lexer on demand through a small ring buffer, so
+// token memory stays bounded no matter how large the input is.
+typedef struct{
+    Lexer* lexer;
+    Token window[TOKEN_LOOKAHEAD];
+    size_t head;    // Slot of the current token
+    size_t count;   // Tokens buffered from head onwards
+    MemCounter mem; // The stream and its lexer
+} TokenStream;
+
+Source* openSource(const char* filename);
+void closeSource(Source* source);
+Lexer* createLexer(const char* input, size_t length, Interner* interner);
+int lexerNextToken(Lexer* l, Token* out);
+TokenBuffer* lex(Source* source, Interner* interner);
+const char* tokenText(TokenType type);
+void freeTokenBuffer(TokenBuffer* tokens);
+Token tokenAt(const TokenBuffer* tokens, int index);
+TokenStream* createTokenStream(Source* source, Interner* interner);
+void freeTokenStream(TokenStream* stream);
+Token* streamPeek(TokenStream* stream, size_t k);
+void streamAdvance(TokenStream* stream);
 #endif
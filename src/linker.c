@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include "linker.h"
+
+// Program headers: the one loadable segment, then PT_GNU_STACK so the
+// stack isn't executable.
+#define PHDR_COUNT 2
+// Section headers: null, .text and .shstrtab, enough for objdump and gdb.
+#define SHDR_COUNT 3
+
+// _start: call main; movl %eax, %ebx; movl $1, %eax (exit); int $0x80
+static const unsigned char startCode[] = {
+    0xE8, 0, 0, 0, 0,
+    0x89, 0xC3,
+    0xB8, 0x01, 0x00, 0x00, 0x00,
+    0xCD, 0x80,
+};
+
+static const char shstrtab[] = "\0.text\0.shstrtab";
+
+// Index of the label called name, or -1.
+static long findGlobal(const Assembler *as, const char *name) {
+    for (size_t l = 0; l < as->labelCount; l++) {
+        if (strcmp(symbolName(as->names, as->labels[l].name), name) == 0) {
+            return (long)l;
+        }
+    }
+    return -1;
+}
+
+int linkExecutable(const Assembler *as, const char *path) {
+    // With a single object, every relocation is to a symbol nothing defines.
+    if (as->relocCount) {
+        fprintf(stderr, "Undefined reference to '%s'\n",
+            symbolName(as->names, as->labels[as->relocs[0].label].name));
+        return 1;
+    }
+    long main = findGlobal(as, "main");
+    if (main < 0 || !as->labels[main].defined) {
+        fprintf(stderr, "Undefined reference to 'main'\n");
+        return 1;
+    }
+
+    // One read/execute segment from the start of the file: headers,
+    // _start, then .text. Only code is laid out; the generator emits no data.
+    size_t headersSize = sizeof(Elf32_Ehdr) + PHDR_COUNT * sizeof(Elf32_Phdr);
+    size_t startOffset = (headersSize + 15) & ~(size_t)15;
+    size_t textOffset = (startOffset + sizeof(startCode) + 15) & ~(size_t)15;
+    size_t codeEnd = textOffset + as->textLength;
+    size_t shstrtabOffset = codeEnd;
+    size_t sectionsOffset = (shstrtabOffset + sizeof(shstrtab) + 3) & ~(size_t)3;
+
+    unsigned char start[sizeof(startCode)];
+    memcpy(start, startCode, sizeof(startCode));
+    int32_t toMain = (int32_t)(textOffset + as->labels[main].address - (startOffset + 5));
+    memcpy(start + 1, &toMain, 4);
+
+    Elf32_Ehdr header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS32;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_386;
+    header.e_version = EV_CURRENT;
+    header.e_entry = (Elf32_Addr)(LINK_BASE + startOffset);
+    header.e_phoff = sizeof(Elf32_Ehdr);
+    header.e_shoff = (Elf32_Off)sectionsOffset;
+    header.e_ehsize = sizeof(Elf32_Ehdr);
+    header.e_phentsize = sizeof(Elf32_Phdr);
+    header.e_phnum = PHDR_COUNT;
+    header.e_shentsize = sizeof(Elf32_Shdr);
+    header.e_shnum = SHDR_COUNT;
+    header.e_shstrndx = 2;
+
+    Elf32_Phdr segments[PHDR_COUNT];
+    memset(segments, 0, sizeof(segments));
+    segments[0].p_type = PT_LOAD;
+    segments[0].p_vaddr = LINK_BASE;
+    segments[0].p_paddr = LINK_BASE;
+    segments[0].p_filesz = (Elf32_Word)codeEnd;
+    segments[0].p_memsz = (Elf32_Word)codeEnd;
+    segments[0].p_flags = PF_R | PF_X;
+    segments[0].p_align = 0x1000;
+    segments[1].p_type = PT_GNU_STACK;
+    segments[1].p_flags = PF_R | PF_W;
+    segments[1].p_align = 16;
+
+    Elf32_Shdr sections[SHDR_COUNT];
+    memset(sections, 0, sizeof(sections));
+    sections[1].sh_name = 1;
+    sections[1].sh_type = SHT_PROGBITS;
+    sections[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    sections[1].sh_addr = (Elf32_Addr)(LINK_BASE + startOffset);
+    sections[1].sh_offset = (Elf32_Off)startOffset;
+    sections[1].sh_size = (Elf32_Word)(codeEnd - startOffset);
+    sections[1].sh_addralign = 16;
+    sections[2].sh_name = 7;
+    sections[2].sh_type = SHT_STRTAB;
+    sections[2].sh_offset = (Elf32_Off)shstrtabOffset;
+    sections[2].sh_size = sizeof(shstrtab);
+    sections[2].sh_addralign = 1;
+
+    // Created like a linker would, executable as far as the umask allows.
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0777);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!file) {
+        perror("Failed to open executable for writing");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    // Gaps between pieces are filled with nops.
+    unsigned char padding[16];
+    memset(padding, 0x90, sizeof(padding));
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(segments, sizeof(Elf32_Phdr), PHDR_COUNT, file);
+    fwrite(padding, 1, startOffset - headersSize, file);
+    fwrite(start, 1, sizeof(start), file);
+    fwrite(padding, 1, textOffset - (startOffset + sizeof(start)), file);
+    fwrite(as->text, 1, as->textLength, file);
+    fwrite(shstrtab, 1, sizeof(shstrtab), file);
+    memset(padding, 0, sizeof(padding));
+    fwrite(padding, 1, sectionsOffset - (shstrtabOffset + sizeof(shstrtab)), file);
+    fwrite(sections, sizeof(Elf32_Shdr), SHDR_COUNT, file);
+    int failed = ferror(file);
+    if (fclose(file) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        perror("Failed to write executable");
+        unlink(path);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,13 @@
+#include "assembler.h"
+#ifndef LINKER_H
+#define LINKER_H
+
+// Executables are loaded at the usual i386 base address.
+#define LINK_BASE 0x08048000
+
+// Link finished assembler output into a static i386 ELF executable at
+// path. A small _start calls main and exits with its return value, so
+// no C runtime is needed. Returns nonzero, after printing why, if
+// anything is left undefined or the file can't be written.
+int linkExecutable(const Assembler *as, const char *path);
+#endif
@@ -2,23 +2,78 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include "parser.h"
+#include "cache.h"
+#include "parallel.h"
 #include "generator.h"
+#include "assembler.h"
+#include "linker.h"
+#include "ir.h"
 #include "lexer.h"
 #include "data.h"
 
 const char *getBasename(const char *filename);
 char *getDirectory(const char *filepath);
-extern Stack* varmaps;
+static void printMemStats(const CompilerContext *ctx, const TokenStream *stream,
+                          const TokenBuffer *tokens, const MemCounter *parser,
+                          const AST *ast, const CodeGenerator *gen,
+                          const Assembler *assembler);
+static int generateAssembly(CodeGenerator *gen, const AST *ast, const char *outputPath,
+                            int *buildFail);
+static int generateObject(CodeGenerator *gen, const AST *ast, Assembler *assembler);
+static int linkObject(const Assembler *assembler, const char *outputPath);
+static int emitIR(CompilerContext *ctx, const AST *ast);
+static void printUsage(const char *program);
+
+extern char **environ;
 
 int main(int argc, char** argv) {
 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+    const char *cFile = NULL;
+    int memStats = 0;
+    int externalAs = 0;
+    int externalLd = 0;
+    int dumpIR = 0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mem-stats") == 0) {
+            memStats = 1;
+        } else if (strcmp(argv[i], "--external-as") == 0) {
+            externalAs = 1;
+        } else if (strcmp(argv[i], "--external-ld") == 0) {
+            externalLd = 1;
+        } else if (strcmp(argv[i], "--emit-ir") == 0) {
+            dumpIR = 1;
+        } else if (strcmp(argv[i], "--jobs") == 0) {
+            // A whole number of threads, at least one.
+            char *end = NULL;
+            errno = 0;
+            jobs = i + 1 < argc ? strtol(argv[++i], &end, 10) : 0;
+            if (!end || end == argv[i] || *end != '\0' || errno != 0
+                || jobs < 1 || jobs > INT_MAX) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        } else {
+            cFile = argv[i];
+        }
+    }
+    if (!cFile) {
+        printUsage(argv[0]);
         return 1;
     }
 
-    const char *cFile = argv[1];
     char *dir = getDirectory(cFile);
     const char *basename = getBasename(cFile);
 
@@ -26,91 +81,141 @@ int main(int argc, char** argv) {
     char outputPath[512];
     snprintf(outputPath, sizeof(outputPath), "%s/%s", dir, basename);
 
-    int token_count = 0;
-    Token** tokens = lex(argv[1], &token_count);
-    if (!tokens) {
-        return 1; // Error occurred in lex()
+    // All state for this compile lives in the context. The source stays
+    // mapped until we exit, since tokens point into it.
+    CompilerContext *ctx = createContext(cFile);
+    if (!ctx) {
+        return 1;
     }
+    Source *source = ctx->source;
 
-    //printf("%d\n", token_count);
-    
     #ifdef DEBUG
-    for (int i = 0; i < token_count && tokens[i] != NULL; i++) {
-        printf("Token: Type=%d, Value='%s', Line=%d\n", tokens[i]->type, tokens[i]->value, tokens[i]->line);
+    TokenBuffer* dump = lex(source, ctx->interner);
+    for (int i = 0; dump && i < dump->count; i++) {
+        printf("Token: Type=%d, Value='%.*s', Line=%d\n", dump->types[i],
+            (int)dump->lengths[i], source->data + dump->offsets[i], dump->lines[i]);
     }
+    freeTokenBuffer(dump);
     #endif
-    
-    // Initialize the parser context.
-    Parser parser;
-    parser.tokens = tokens;
-    parser.currentIndex = 0;
-    parser.tokenCount = token_count;
-    parser.errorFlag = 0;
-
-    // Parse the tokens into an AST.
-    ASTNode *ast = parseProgram(&parser);
-    if (parser.errorFlag) {
-        //printf("Do better.\n");
-        freeAST(ast);
-        freeTokens(tokens, token_count);
-        free((void *)basename);
-        free((void *)dir);
-        return 1;
+
+    // An unchanged source can reuse the tree from an earlier compile.
+    AST *ast = loadCachedAST(ctx);
+    TokenStream *stream = NULL;
+    TokenBuffer *tokens = NULL;
+    MemCounter parserMem = { 0, 0, 0 };
+    if (!ast) {
+        int errorFlag = 0;
+        if (jobs > 1 && source->length >= PARALLEL_MIN_BYTES) {
+            // Large input: lex it all up front so functions can be
+            // parsed on several threads.
+            tokens = lex(source, ctx->interner);
+            if (!tokens || tokens->count == 0) {
+                return 1; // Nothing to compile
+            }
+            ast = parseParallel(ctx, tokens, jobs, &errorFlag, &parserMem);
+        } else {
+            // Tokens are lexed on demand as the parser pulls them.
+            stream = createTokenStream(source, ctx->interner);
+            if (streamPeek(stream, 0)->type == TOKEN_EOF) {
+                return 1; // Nothing to compile
+            }
+
+            // Parse the tokens into an AST.
+            Parser parser;
+            initParser(&parser, ctx, createAST());
+            parser.stream = stream;
+            ast = parser.ast;
+            parseProgram(&parser);
+            errorFlag = parser.errorFlag;
+            parserMem = parser.mem;
+            freeParser(&parser);
+        }
+        if (errorFlag) {
+            //printf("Do better.\n");
+            freeAST(ast);
+            freeTokenStream(stream);
+            freeTokenBuffer(tokens);
+            freeContext(ctx);
+            free((void *)basename);
+            free((void *)dir);
+            return 1;
+        }
+        storeCachedAST(ctx, ast);
+    }
+    #ifdef DEBUG
+    if (ctx->cacheDir) {
+        printf("AST cache: %d hit, %d miss\n", ctx->cacheHits, ctx->cacheMisses);
     }
+    #endif
 
     // Print the tree.
     #ifdef DEBUG
     //printf("Parsing complete!\n\nAST:\n");
-    printAST(ast, 0);
+    printAST(ast, ast->root, ctx->interner, 0);
     #endif
 
-    // Generate x86 code.
-    CodeGenerator generator;
-    initStringBuffer(&generator.sb);
-    int compileFail = generateX86(&generator, ast);
-
-    if (compileFail != 0) {
-        printf("Damn.\n");
-        return 1;
-    }
-  
-    // Put into a file.
-    FILE *file = fopen("asm.s", "w");
-    if (!file) {
-        perror("Failed to open asm.s for writing");
+    // --emit-ir stops at the IR and prints it instead of generating code.
+    if (dumpIR) {
+        int failed = emitIR(ctx, ast);
         freeAST(ast);
-        freeTokens(tokens, token_count);
+        freeTokenStream(stream);
+        freeTokenBuffer(tokens);
+        freeContext(ctx);
         free((void *)basename);
         free((void *)dir);
+        return failed;
+    }
+
+    // A gcc that exits early shows up as a failed write, not a signal.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Generate x86 code and assemble it as it's produced. With
+    // --external-as, or if the built-in assembler meets anything it can't
+    // encode, the code is piped to gcc to assemble and link instead.
+    CodeGenerator generator;
+    initCodeGenerator(&generator, ctx);
+    Assembler *assembler = externalAs ? NULL : createAssembler(ctx->interner);
+    int compileFail;
+    int ret = 0;
+    if (assembler) {
+        compileFail = generateObject(&generator, ast, assembler);
+        if (compileFail < 0) {
+            #ifdef DEBUG
+            printf("Built-in assembler failed, using gcc.\n");
+            #endif
+            freeAssembler(assembler);
+            assembler = NULL;
+            freeCodeGenerator(&generator);
+            initCodeGenerator(&generator, ctx);
+            compileFail = generateAssembly(&generator, ast, outputPath, &ret);
+        }
+    } else {
+        compileFail = generateAssembly(&generator, ast, outputPath, &ret);
+    }
+    if (compileFail != 0) {
+        printf("Damn.\n");
         return 1;
     }
-    fprintf(file, "%s", generator.sb.data);
-    fclose(file);   
-    #ifdef DEBUG
-    printf("Assembly code written to asm.s:\n%s\n", generator.sb.data);
-    #endif
 
+    // Link in-process unless asked not to. gcc is only needed to link
+    // with --external-ld or to assemble what the built-in assembler can't.
     const char *exeName = outputPath;
-    char command[1024];
-    snprintf(command, sizeof(command), "gcc -m32 asm.s -o %s", outputPath);
-    int ret = system(command);
+    if (assembler) {
+        ret = externalLd ? linkObject(assembler, outputPath)
+                         : linkExecutable(assembler, outputPath);
+    }
     if (ret != 0) {
-        fprintf(stderr, "Compilation failed with exit code %d\n", ret);
         freeAST(ast);
-        freeTokens(tokens, token_count);
+        freeTokenStream(stream);
+        freeTokenBuffer(tokens);
+        freeContext(ctx);
         free((void *)basename);
         free((void *)dir);
         return ret;
     }
 
-    ret = system("rm asm.s");
-    if (ret != 0) {
-        fprintf(stderr, "Deletion failed with %d\n", ret);
-        freeAST(ast);
-        freeTokens(tokens, token_count);
-        free((void *)basename);
-        free((void *)dir);
-        return ret;
+    if (memStats) {
+        printMemStats(ctx, stream, tokens, &parserMem, ast, &generator, assembler);
     }
 
     //printf("Compilation succeeded: executable '%s' created.\n", exeName);
@@ -122,20 +227,271 @@ int main(int argc, char** argv) {
     if (ret != 0) {
         fprintf(stderr, "Deletion failed with %d\n", ret);
         freeAST(ast);
-        freeTokens(tokens, token_count);
+        freeTokenStream(stream);
+        freeTokenBuffer(tokens);
+        freeContext(ctx);
         free((void *)basename);
         free((void *)dir);
         return ret;
     }
 
-    free(generator.sb.data);
+    freeCodeGenerator(&generator);
+    freeAssembler(assembler);
     freeAST(ast);
-    freeTokens(tokens, token_count);
+    freeTokenStream(stream);
+    freeTokenBuffer(tokens);
+    freeContext(ctx);
     free((void *)basename);
     free((void *)dir);
     return 0;
 }
 
+// Lower each function, check it and print it to stdout. Returns nonzero
+// if the program has errors or the IR doesn't verify.
+static void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [--mem-stats] [--jobs N] [--external-as] [--external-ld] [--emit-ir] <filename>\n", program);
+}
+
+static int emitIR(CompilerContext *ctx, const AST *ast) {
+    IRBuilder builder;
+    initIRBuilder(&builder, ctx, ast);
+    int failed = 0;
+    const ASTNode *program = astNode(ast, ast->root);
+    for (uint32_t i = 0; i < program->program.count; i++) {
+        if (lowerFunction(&builder, ast->lists[program->program.first + i]) != 0) {
+            failed = 1;
+            continue;
+        }
+        if (verifyIR(&builder.func, ctx->interner, stderr) != 0) {
+            failed = 1;
+        }
+        printIR(&builder.func, ctx->interner, stdout);
+    }
+    freeIRBuilder(&builder);
+    return failed;
+}
+
+// Start gcc with argv, reading stdin from input if it isn't -1. gcc runs
+// in its own process group so it can be stopped along with its children.
+// Returns the pid, or -1 after printing why.
+static pid_t spawnGcc(char *const argv[], int input) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    if (input >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, input, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, input);
+    }
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(err));
+        return -1;
+    }
+    return pid;
+}
+
+// Wait for gcc. Returns 0 if it succeeded, else 1 after printing why.
+static int waitGcc(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("Failed to wait for gcc");
+            return 1;
+        }
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        return 0;
+    }
+    if (WIFEXITED(status)) {
+        fprintf(stderr, "Compilation failed with exit code %d\n", WEXITSTATUS(status));
+    } else {
+        fprintf(stderr, "Compilation failed: gcc killed by signal %d\n", WTERMSIG(status));
+    }
+    return 1;
+}
+
+// Generate straight into a pipe to gcc, which assembles and links it into
+// outputPath. No shell and no temporary file is involved, so concurrent
+// compiles can't collide. Returns nonzero if the program has errors; if
+// it doesn't, *buildFail is set if gcc failed.
+static int generateAssembly(CodeGenerator *gen, const AST *ast, const char *outputPath,
+                            int *buildFail) {
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) {
+        perror("Failed to create pipe");
+        *buildFail = 1;
+        return 0;
+    }
+    fcntl(pipeFds[1], F_SETFD, FD_CLOEXEC);
+    char *argv[] = { "gcc", "-m32", "-x", "assembler", "-", "-o", (char *)outputPath, NULL };
+    pid_t pid = spawnGcc(argv, pipeFds[0]);
+    close(pipeFds[0]);
+    if (pid < 0) {
+        close(pipeFds[1]);
+        *buildFail = 1;
+        return 0;
+    }
+    // Debug builds keep the whole listing in memory so it can be printed.
+    #ifndef DEBUG
+    gen->output = pipeFds[1];
+    #endif
+    int compileFail = generateX86(gen, ast);
+    #ifdef DEBUG
+    if (compileFail == 0) {
+        printf("Assembly code:\n%s\n", gen->sb.data);
+        if (write(pipeFds[1], gen->sb.data, gen->sb.length) != (ssize_t)gen->sb.length) {
+            perror("Failed to write assembly");
+        }
+    }
+    #endif
+    close(pipeFds[1]);
+    if (compileFail != 0) {
+        // Don't let gcc build anything from a partial listing.
+        kill(-pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return compileFail;
+    }
+    *buildFail = waitGcc(pid);
+    return 0;
+}
+
+// Generate through the built-in assembler. Returns nonzero if
+// the program has errors, or -1 if the assembler couldn't handle it.
+static int generateObject(CodeGenerator *gen, const AST *ast, Assembler *assembler) {
+    #ifndef DEBUG
+    gen->assembler = assembler;
+    #endif
+    int compileFail = generateX86(gen, ast);
+    if (compileFail != 0) {
+        return compileFail;
+    }
+    #ifdef DEBUG
+    printf("Assembly code:\n%s\n", gen->sb.data);
+    assembleText(assembler, gen->sb.data, gen->sb.length);
+    #endif
+    return finishAssembly(assembler) != 0 ? -1 : 0;
+}
+
+// Link the built-in assembler's output with gcc. The object goes to a
+// uniquely named temporary file, since gcc can't read one from a pipe.
+// Returns nonzero, after printing why, on failure.
+static int linkObject(const Assembler *assembler, const char *outputPath) {
+    const char *tmpdir = getenv("TMPDIR");
+    char objectPath[512];
+    snprintf(objectPath, sizeof(objectPath), "%s/c3-XXXXXX.o", tmpdir && *tmpdir ? tmpdir : "/tmp");
+    int fd = mkstemps(objectPath, 2);
+    if (fd < 0) {
+        perror("Failed to create temporary object");
+        return 1;
+    }
+    close(fd);
+    int ret = 1;
+    if (writeObject(assembler, objectPath) != 0) {
+        perror("Failed to write temporary object");
+    } else {
+        char *argv[] = { "gcc", "-m32", objectPath, "-o", (char *)outputPath, NULL };
+        pid_t pid = spawnGcc(argv, -1);
+        ret = pid < 0 ? 1 : waitGcc(pid);
+    }
+    unlink(objectPath);
+    return ret;
+}
+
+// Heap use by phase and structure, written to stderr for --mem-stats.
+// Counts are calls to malloc/realloc, the bytes requested and the bytes
+// still held at exit; per-token and per-node figures use the latter.
+// Memory that is mmapped (the source, a cached AST) isn't included. The lexer runs
+// inside the parser's token stream (or up front into a token buffer for a
+// parallel parse), so "lex" means memory owned by the lexer, not time spent in it.
+static void printMemStats(const CompilerContext *ctx, const TokenStream *stream,
+                          const TokenBuffer *tokens, const MemCounter *parser,
+                          const AST *ast, const CodeGenerator *gen,
+                          const Assembler *assembler) {
+    MemCounter none = { 0, 0, 0 };
+    MemCounter interner = ctx->interner->mem;
+    interner.allocations += ctx->interner->text->mem.allocations;
+    interner.bytes += ctx->interner->text->mem.bytes;
+    interner.live += ctx->interner->text->mem.live;
+    MemCounter symtab = none;
+    if (gen->ir.scopes) {
+        symtab = gen->ir.scopes->mem;
+        symtab.allocations += gen->ir.scopes->visible->mem.allocations;
+        symtab.bytes += gen->ir.scopes->visible->mem.bytes;
+        symtab.live += gen->ir.scopes->visible->mem.live;
+    }
+    MemCounter as = assembler ? assembler->mem : none;
+    if (assembler) {
+        const HashMap *labelIndex = assembler->labelIndex;
+        as.allocations += labelIndex->mem.allocations;
+        as.bytes += labelIndex->mem.bytes;
+        as.live += labelIndex->mem.live;
+    }
+    struct {
+        const char *phase;
+        const char *name;
+        MemCounter mem;
+    } rows[] = {
+        { "lex",     "source",        ctx->source->mem },
+        { "lex",     "token stream",  stream ? stream->mem : none },
+        { "lex",     "token buffer",  tokens ? tokens->mem : none },
+        { "lex",     "interner",      interner },
+        { "parse",   "ast nodes",     ast->nodeMem },
+        { "parse",   "ast lists",     ast->listMem },
+        { "parse",   "parser stacks", *parser },
+        { "codegen", "symbol tables", symtab },
+        { "codegen", "ir",            gen->ir.mem },
+        { "codegen", "regalloc",      gen->regs.mem },
+        { "emit",    "asm text",      gen->sb.mem },
+        { "emit",    "assembler",     as },
+    };
+    const char *phases[] = { "lex", "parse", "codegen", "emit" };
+    size_t rowCount = sizeof(rows) / sizeof(rows[0]);
+
+    fprintf(stderr, "%-8s %-14s %10s %14s %14s\n", "phase", "structure", "allocs", "bytes", "live");
+    for (size_t i = 0; i < rowCount; i++) {
+        fprintf(stderr, "%-8s %-14s %10zu %14zu %14zu\n", rows[i].phase, rows[i].name,
+            rows[i].mem.allocations, rows[i].mem.bytes, rows[i].mem.live);
+    }
+    size_t lexBytes = 0, parseBytes = 0;
+    for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+        MemCounter total = { 0, 0, 0 };
+        for (size_t i = 0; i < rowCount; i++) {
+            if (strcmp(rows[i].phase, phases[p]) == 0) {
+                total.allocations += rows[i].mem.allocations;
+                total.bytes += rows[i].mem.bytes;
+                total.live += rows[i].mem.live;
+            }
+        }
+        if (p == 0) lexBytes = total.live;
+        if (p == 1) parseBytes = total.live;
+        fprintf(stderr, "%-8s %-14s %10zu %14zu %14zu\n", phases[p], "total",
+            total.allocations, total.bytes, total.live);
+    }
+
+    size_t tokenCount = stream ? stream->lexer->tokenCount : tokens ? (size_t)tokens->count : 0;
+    size_t nodes = ast->nodeCount - 1; // Slot 0 is NO_NODE
+    if (tokenCount) {
+        fprintf(stderr, "tokens: %zu (%.2f bytes/token)\n", tokenCount, (double)lexBytes / tokenCount);
+    } else {
+        fprintf(stderr, "tokens: 0 (AST loaded from cache)\n");
+    }
+    if (ast->mapping) {
+        fprintf(stderr, "ast nodes: %zu (mapped from cache)\n", nodes);
+    } else if (nodes) {
+        fprintf(stderr, "ast nodes: %zu (%.2f bytes/node)\n", nodes, (double)parseBytes / nodes);
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(stderr, "peak RSS: %ld KiB\n", usage.ru_maxrss);
+    }
+}
+
 const char *getBasename(const char *filename) {
     const char *base = strrchr(filename, '/'); // Get last part after '/'
     base = (base) ? base + 1 : filename;       // If '/' found, move past it
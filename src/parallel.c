@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "parallel.h"
+
+// Tokens [start, end) holding one top-level function.
+typedef struct {
+    int start;
+    int end;
+} TokenRange;
+
+// One thread's share: a contiguous run of functions, parsed into the
+// worker's own AST so that no allocation is shared between threads.
+typedef struct {
+    CompilerContext *ctx;
+    TokenBuffer *tokens;
+    const TokenRange *ranges;
+    int count;
+    NodeIndex *functions;   // Function node of each range, in ast
+    AST *ast;
+    MemCounter mem;
+    int failed;
+    pthread_t thread;
+} Worker;
+
+static void addCounter(MemCounter *into, const MemCounter *from) {
+    into->allocations += from->allocations;
+    into->bytes += from->bytes;
+    into->live += from->live;
+}
+
+// Split the tokens into `int name ( ) { ... }` ranges by matching braces.
+// Returns the number of functions, or -1 if anything at top level
+// doesn't fit that shape (the sequential parser then reports it).
+static int splitFunctions(const TokenBuffer *tokens, TokenRange **out) {
+    const unsigned char *types = tokens->types;
+    int capacity = 64, count = 0;
+    TokenRange *ranges = malloc(capacity * sizeof(TokenRange));
+    int i = 0;
+    while (i < tokens->count) {
+        if (i + 4 >= tokens->count
+            || types[i] != KEYW_INT
+            || types[i + 1] != TOKEN_IDENTIFIER
+            || types[i + 2] != TOKEN_OPAREN
+            || types[i + 3] != TOKEN_CPAREN
+            || types[i + 4] != TOKEN_OBRACE) {
+            free(ranges);
+            return -1;
+        }
+        int depth = 0;
+        int j = i + 4;
+        for (; j < tokens->count; j++) {
+            if (types[j] == TOKEN_OBRACE) {
+                depth++;
+            } else if (types[j] == TOKEN_CBRACE && --depth == 0) {
+                break;
+            }
+        }
+        if (j == tokens->count) {
+            free(ranges);
+            return -1;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            ranges = realloc(ranges, capacity * sizeof(TokenRange));
+        }
+        ranges[count].start = i;
+        ranges[count].end = j + 1;
+        count++;
+        i = j + 1;
+    }
+    *out = ranges;
+    return count;
+}
+
+static void *parseRanges(void *arg) {
+    Worker *worker = arg;
+    Parser parser;
+    initParser(&parser, worker->ctx, worker->ast);
+    parser.tokens = worker->tokens;
+    parser.errors = NULL;   // A failure is re-parsed sequentially for its messages
+    for (int i = 0; i < worker->count; i++) {
+        parser.currentIndex = worker->ranges[i].start;
+        parser.tokenEnd = worker->ranges[i].end;
+        NodeIndex func = parseFunction(&parser);
+        if (!func || parser.errorFlag || parser.currentIndex != worker->ranges[i].end) {
+            worker->failed = 1;
+            break;
+        }
+        worker->functions[i] = func;
+    }
+    worker->mem = parser.mem;
+    freeParser(&parser);
+    return NULL;
+}
+
+static AST *parseSequential(CompilerContext *ctx, TokenBuffer *tokens, int *errorFlag, MemCounter *mem) {
+    Parser parser;
+    initParser(&parser, ctx, createAST());
+    parser.tokens = tokens;
+    parser.tokenEnd = tokens->count;
+    parseProgram(&parser);
+    *errorFlag = parser.errorFlag;
+    addCounter(mem, &parser.mem);
+    freeParser(&parser);
+    return parser.ast;
+}
+
+AST *parseParallel(CompilerContext *ctx, TokenBuffer *tokens, int jobs,
+                   int *errorFlag, MemCounter *mem) {
+    TokenRange *ranges = NULL;
+    int count = jobs > 1 ? splitFunctions(tokens, &ranges) : -1;
+    if (count < 2) {
+        free(ranges);
+        return parseSequential(ctx, tokens, errorFlag, mem);
+    }
+
+    // Hand each worker a contiguous run holding about the same number of
+    // tokens. The split depends only on the input and the job count, so
+    // the stitched tree is the same on every run.
+    int workerCount = jobs < count ? jobs : count;
+    Worker *workers = calloc(workerCount, sizeof(Worker));
+    NodeIndex *functions = malloc(count * sizeof(NodeIndex));
+    int next = 0;
+    for (int w = 0; w < workerCount; w++) {
+        long target = (long)tokens->count * (w + 1) / workerCount;
+        int first = next;
+        // Leave at least one function for each remaining worker.
+        int last = count - (workerCount - w - 1);
+        next++;
+        while (next < last && ranges[next].end <= target) {
+            next++;
+        }
+        if (w == workerCount - 1) {
+            next = count;
+        }
+        workers[w].ctx = ctx;
+        workers[w].tokens = tokens;
+        workers[w].ranges = ranges + first;
+        workers[w].count = next - first;
+        workers[w].functions = functions + first;
+        workers[w].ast = createAST();
+    }
+
+    // Worker 0 runs on this thread. If a thread can't be started, its
+    // share is parsed here too.
+    for (int w = 1; w < workerCount; w++) {
+        if (pthread_create(&workers[w].thread, NULL, parseRanges, &workers[w]) != 0) {
+            parseRanges(&workers[w]);
+            workers[w].thread = pthread_self();
+        }
+    }
+    parseRanges(&workers[0]);
+    int failed = workers[0].failed;
+    for (int w = 1; w < workerCount; w++) {
+        if (!pthread_equal(workers[w].thread, pthread_self())) {
+            pthread_join(workers[w].thread, NULL);
+        }
+        failed |= workers[w].failed;
+    }
+
+    AST *ast = NULL;
+    if (failed) {
+        for (int w = 0; w < workerCount; w++) {
+            freeAST(workers[w].ast);
+        }
+        ast = parseSequential(ctx, tokens, errorFlag, mem);
+    } else {
+        // Stitch: append each worker's nodes in order and fix up indices.
+        ast = createAST();
+        Parser parser;
+        initParser(&parser, ctx, ast);
+        for (int w = 0; w < workerCount; w++) {
+            NodeIndex offset = appendAST(ast, workers[w].ast);
+            for (int i = 0; i < workers[w].count; i++) {
+                workers[w].functions[i] += offset;
+            }
+            addCounter(mem, &workers[w].mem);
+            freeAST(workers[w].ast);
+        }
+        makeProgram(&parser, functions, count);
+        addCounter(mem, &parser.mem);
+        freeParser(&parser);
+        *errorFlag = 0;
+    }
+
+    free(functions);
+    free(workers);
+    free(ranges);
+    return ast;
+}
@@ -0,0 +1,17 @@
+#include "parser.h"
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Sources at least this large are lexed up front and their functions
+// parsed on several threads; smaller ones aren't worth the thread setup.
+#define PARALLEL_MIN_BYTES (64 * 1024)
+
+// Parse a fully lexed program with up to jobs threads. Each top-level
+// function is parsed independently and the results are stitched into
+// one AST in source order. Diagnostics match a sequential parse: if any
+// function fails, the whole buffer is parsed again on this thread and
+// that parse reports the errors. Parser memory is added to *mem.
+AST *parseParallel(CompilerContext *ctx, TokenBuffer *tokens, int jobs,
+                   int *errorFlag, MemCounter *mem);
+
+#endif
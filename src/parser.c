@@ -2,631 +2,927 @@
 #include "parser.h"
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+
+
+// Set up a parser appending to ast. The caller then points it at a
+// token stream, or at a token buffer and the range to read.
+void initParser(Parser *parser, CompilerContext *ctx, AST *ast) {
+    parser->ctx = ctx;
+    parser->ast = ast;
+    parser->stream = NULL;
+    parser->tokens = NULL;
+    parser->currentIndex = 0;
+    parser->tokenEnd = 0;
+    parser->errorFlag = 0;
+    parser->errors = stderr;
+    parser->scratch = NULL;
+    parser->scratchCount = 0;
+    parser->scratchCapacity = 0;
+    memset(&parser->mem, 0, sizeof(MemCounter));
+}
 
+void freeParser(Parser *parser) {
+    free(parser->scratch);
+    parser->scratch = NULL;
+    parser->scratchCount = parser->scratchCapacity = 0;
+}
 
 void reportError(Parser *parser, const char *message) {
-    fprintf(stderr, "Parse error: %s at token '%s', on line %d\n",
-        message,
-        currentToken(parser)->value ? currentToken(parser)->value : "EOF",
-        currentToken(parser)->line);
     parser->errorFlag = 1;
+    if (!parser->errors) {
+        return;
+    }
+    Token t = currentToken(parser);
+    if (t.type == TOKEN_EOF) {
+        fprintf(parser->errors, "Parse error: %s at token 'EOF', on line %d\n", message, t.line);
+    } else {
+        fprintf(parser->errors, "Parse error: %s at token '%.*s', on line %d\n",
+            message, (int)t.length, parser->ctx->source->data + t.offset, t.line);
+    }
 }
 
-int precedence(TokenType type) {
-    switch (type) {
-        case OP_MUL:
-        case OP_DIV:        return 8;
-        case OP_ADD:
-        case OP_NEGATION:   return 7;
-        case OP_LESS:
-        case OP_LESSEQ:
-        case OP_GREATER:
-        case OP_GREATEREQ:  return 6;
-        case OP_EQ:
-        case OP_NOTEQ:      return 5;
-        case OP_AND:        return 4;
-        case OP_OR:         return 3;
-        case OP_Q:          return 2;
-        case OP_ASSN:       return 1;
-        default:            return 0;
+// Interned symbol of the current identifier or literal token.
+static Symbol currentSymbol(Parser *parser) {
+    if (parser->stream) {
+        return streamPeek(parser->stream, 0)->symbol;
     }
+    return parser->tokens->symbols[parser->currentIndex];
+}
+
+// Binding power of each binary operator; 0 for everything else.
+static const unsigned char bindingPower[TOKEN_INVALID + 1] = {
+    [OP_MUL] = 8,       [OP_DIV] = 8,
+    [OP_ADD] = 7,       [OP_NEGATION] = 7,
+    [OP_LESS] = 6,      [OP_LESSEQ] = 6,    [OP_GREATER] = 6,   [OP_GREATEREQ] = 6,
+    [OP_EQ] = 5,        [OP_NOTEQ] = 5,
+    [OP_AND] = 4,
+    [OP_OR] = 3,
+    [OP_Q] = 2,
+    [OP_ASSN] = 1,
+};
+
+int precedence(TokenType type) {
+    return bindingPower[type];
 }
 
 // Get tokens, report an error
 void consume(Parser *parser, TokenType expected, const char *errorMsg) {
-    if (currentToken(parser)->type != expected) {
+    if (currentType(parser) != expected) {
         reportError(parser, errorMsg);
         return;
     }
+    advance(parser);
+}
+
+TokenType currentType(Parser *parser) {
+    if (parser->stream) {
+        return streamPeek(parser->stream, 0)->type;
+    }
+    if (parser->currentIndex < parser->tokenEnd) {
+        return parser->tokens->types[parser->currentIndex];
+    }
+    return TOKEN_EOF;
+}
+
+Token currentToken(Parser *parser) {
+    if (parser->stream) {
+        return *streamPeek(parser->stream, 0);
+    }
+    if (parser->currentIndex < parser->tokenEnd) {
+        return tokenAt(parser->tokens, parser->currentIndex);
+    }
+    Token eofToken = { TOKEN_EOF, 0, 0, NO_SYMBOL, 0 };
+    return eofToken;
+}
+
+void advance(Parser *parser) {
+    if (parser->stream) {
+        streamAdvance(parser->stream);
+        return;
+    }
     parser->currentIndex++;
 }
 
-Token *currentToken(Parser *parser) {
-    if (parser->currentIndex < parser->tokenCount) {
-        return parser->tokens[parser->currentIndex];
+AST *createAST() {
+    AST *ast = malloc(sizeof(AST));
+    ast->nodeCapacity = 1024;
+    ast->nodes = malloc(ast->nodeCapacity * sizeof(ASTNode));
+    ast->nodeCount = 1; // Index 0 is NO_NODE
+    memset(&ast->nodes[0], 0, sizeof(ASTNode));
+    ast->listCapacity = 256;
+    ast->lists = malloc(ast->listCapacity * sizeof(NodeIndex));
+    ast->listCount = 0;
+    ast->root = NO_NODE;
+    ast->mapping = NULL;
+    ast->mappingSize = 0;
+    memset(&ast->nodeMem, 0, sizeof(MemCounter));
+    memset(&ast->listMem, 0, sizeof(MemCounter));
+    countAlloc(&ast->nodeMem, sizeof(AST) + ast->nodeCapacity * sizeof(ASTNode));
+    countAlloc(&ast->listMem, ast->listCapacity * sizeof(NodeIndex));
+    return ast;
+}
+
+// The tree is two arrays, so teardown is O(1) in the number of nodes.
+void freeAST(AST *ast) {
+    if (ast) {
+        if (ast->mapping) {
+            munmap(ast->mapping, ast->mappingSize);
+        } else {
+            free(ast->nodes);
+            free(ast->lists);
+        }
+        free(ast);
+    }
+}
+
+static void reserveNodes(AST *ast, uint32_t count) {
+    while (ast->nodeCount + count > ast->nodeCapacity) {
+        ast->nodeCapacity *= 2;
+        ast->nodes = realloc(ast->nodes, ast->nodeCapacity * sizeof(ASTNode));
+        countResize(&ast->nodeMem, ast->nodeCapacity / 2 * sizeof(ASTNode), ast->nodeCapacity * sizeof(ASTNode));
     }
-    static Token eofToken = { TOKEN_EOF, NULL };
-    return &eofToken;
 }
 
-Token *nextToken(Parser *parser) {
-    if (parser->currentIndex + 1 < parser->tokenCount) {
-        return parser->tokens[parser->currentIndex + 1];
+static void reserveLists(AST *ast, uint32_t count) {
+    while (ast->listCount + count > ast->listCapacity) {
+        ast->listCapacity *= 2;
+        ast->lists = realloc(ast->lists, ast->listCapacity * sizeof(NodeIndex));
+        countResize(&ast->listMem, ast->listCapacity / 2 * sizeof(NodeIndex), ast->listCapacity * sizeof(NodeIndex));
     }
-    static Token eofToken = { TOKEN_EOF, NULL };
-    return &eofToken;
 }
 
-ASTNode *newASTNode(ASTNodeType type) {
-    ASTNode *node = malloc(sizeof(ASTNode));
-    node->type = type;
-    return node;
+// Shift a child reference by offset, leaving NO_NODE alone.
+static inline NodeIndex relocate(NodeIndex index, NodeIndex offset) {
+    return index == NO_NODE ? NO_NODE : index + offset;
+}
+
+// Copy every node and child list of from onto the end of into, fixing up
+// the indices they hold. Node i of from becomes node i + offset of into;
+// the offset is returned. from's root is not made into's root.
+NodeIndex appendAST(AST *into, const AST *from) {
+    uint32_t count = from->nodeCount - 1; // Skip NO_NODE
+    NodeIndex offset = into->nodeCount - 1;
+    uint32_t listOffset = into->listCount;
+    reserveNodes(into, count);
+    reserveLists(into, from->listCount);
+
+    ASTNode *nodes = into->nodes + into->nodeCount;
+    memcpy(nodes, from->nodes + 1, count * sizeof(ASTNode));
+    for (uint32_t i = 0; i < count; i++) {
+        ASTNode *n = &nodes[i];
+        switch (n->type) {
+            case AST_PROGRAM:
+                n->program.first += listOffset;
+                break;
+            case AST_FUNCTION:
+                n->function.body = relocate(n->function.body, offset);
+                break;
+            case AST_BLOCK:
+                n->block.first += listOffset;
+                break;
+            case AST_RETURN:
+                n->retn.expression = relocate(n->retn.expression, offset);
+                break;
+            case AST_IF:
+                n->ifstmt.condition = relocate(n->ifstmt.condition, offset);
+                n->ifstmt.body = relocate(n->ifstmt.body, offset);
+                n->ifstmt.elsestmt = relocate(n->ifstmt.elsestmt, offset);
+                break;
+            case AST_FOR:
+                n->forstmt.parts += listOffset;
+                break;
+            case AST_TERNARY:
+                n->ternary.condition = relocate(n->ternary.condition, offset);
+                n->ternary.trueCond = relocate(n->ternary.trueCond, offset);
+                n->ternary.falseCond = relocate(n->ternary.falseCond, offset);
+                break;
+            case AST_DECL:
+                n->decl.initializer = relocate(n->decl.initializer, offset);
+                break;
+            case AST_UNARY:
+                n->unary.operand = relocate(n->unary.operand, offset);
+                break;
+            case AST_BINARY:
+                n->binary.left = relocate(n->binary.left, offset);
+                n->binary.right = relocate(n->binary.right, offset);
+                break;
+            default:
+                break;
+        }
+    }
+    into->nodeCount += count;
+
+    for (uint32_t i = 0; i < from->listCount; i++) {
+        into->lists[into->listCount + i] = relocate(from->lists[i], offset);
+    }
+    into->listCount += from->listCount;
+    return offset;
+}
+
+// Nodes come zeroed. Growing the array moves every node, so hold indices,
+// not ASTNode pointers, across calls that can add nodes.
+NodeIndex newASTNode(Parser *parser, ASTNodeType type) {
+    AST *ast = parser->ast;
+    reserveNodes(ast, 1);
+    NodeIndex index = ast->nodeCount++;
+    memset(&ast->nodes[index], 0, sizeof(ASTNode));
+    ast->nodes[index].type = type;
+    return index;
+}
+
+static inline ASTNode *node(Parser *parser, NodeIndex index) {
+    return astNode(parser->ast, index);
+}
+
+// Copy a finished child list into the AST; returns where it starts.
+// An empty list may come with items == NULL (nothing pushed yet).
+static uint32_t addList(Parser *parser, const NodeIndex *items, uint32_t count) {
+    AST *ast = parser->ast;
+    uint32_t first = ast->listCount;
+    if (count == 0) {
+        return first;
+    }
+    reserveLists(ast, count);
+    memcpy(ast->lists + first, items, count * sizeof(NodeIndex));
+    ast->listCount += count;
+    return first;
+}
+
+// Child lists are built on the parser's scratch stack. A list opens at
+// the current top; nested lists push above it and are gone again by the
+// time it closes, so closing copies one contiguous run into the AST at
+// its exact size. Use this for any list whose length isn't known up front.
+static uint32_t openList(Parser *parser) {
+    return parser->scratchCount;
+}
+
+static void pushChild(Parser *parser, NodeIndex child) {
+    if (parser->scratchCount == parser->scratchCapacity) {
+        uint32_t oldCapacity = parser->scratchCapacity;
+        parser->scratchCapacity = parser->scratchCapacity ? parser->scratchCapacity * 2 : 64;
+        parser->scratch = realloc(parser->scratch, parser->scratchCapacity * sizeof(NodeIndex));
+        countResize(&parser->mem, oldCapacity * sizeof(NodeIndex), parser->scratchCapacity * sizeof(NodeIndex));
+    }
+    parser->scratch[parser->scratchCount++] = child;
+}
+
+// Move the children pushed since mark into the AST; returns where they start.
+static uint32_t closeList(Parser *parser, uint32_t mark) {
+    uint32_t first = addList(parser, parser->scratch + mark, parser->scratchCount - mark);
+    parser->scratchCount = mark;
+    return first;
 }
 
 void skip(Parser *parser) {
-    while (currentToken(parser)->type != TOKEN_SEMICOL &&
-            currentToken(parser)->type != TOKEN_CBRACE &&
-            currentToken(parser)->type != TOKEN_EOF) {
-        parser->currentIndex++;
+    while (currentType(parser) != TOKEN_SEMICOL &&
+            currentType(parser) != TOKEN_CBRACE &&
+            currentType(parser) != TOKEN_EOF) {
+        advance(parser);
     }
-    if (currentToken(parser)->type == TOKEN_SEMICOL) {
-        parser->currentIndex++;
+    if (currentType(parser) == TOKEN_SEMICOL) {
+        advance(parser);
     }
     //parser->errorFlag = 0;
 }
 
-ASTNode *parseProgram(Parser* parser) {
-    ASTNode *node = newASTNode(AST_PROGRAM);
-    node->program.functions = NULL;
-    node->program.functionCount = 0;
+static NodeIndex closeProgram(Parser *parser, uint32_t mark);
 
-    while (currentToken(parser)->type != TOKEN_EOF) {
+NodeIndex parseProgram(Parser* parser) {
+    uint32_t functions = openList(parser);
+
+    while (currentType(parser) != TOKEN_EOF) {
         // In top-level, we only expect functions starting with 'int'.
-        if (currentToken(parser)->type != KEYW_INT) {
+        if (currentType(parser) != KEYW_INT) {
             reportError(parser, "Expected function to start with 'int'");
             // Skip the current token to avoid an infinite loop.
-            parser->currentIndex++;
+            advance(parser);
             continue;
         }
-        ASTNode *func = parseFunction(parser);
+        NodeIndex func = parseFunction(parser);
         if (func) {
-            node->program.functionCount++;
-            node->program.functions = realloc(node->program.functions,
-            sizeof(ASTNode *) * node->program.functionCount);
-            node->program.functions[node->program.functionCount - 1] = func;
+            pushChild(parser, func);
         } else {
             skip(parser);
         }
     }
-    return node;
+
+    return closeProgram(parser, functions);
 }
 
-ASTNode *parseFunction(Parser* parser) {
-    if (currentToken(parser)->type != KEYW_INT) {
+// Make the program node from the functions pushed since mark.
+static NodeIndex closeProgram(Parser *parser, uint32_t mark) {
+    NodeIndex root = newASTNode(parser, AST_PROGRAM);
+    node(parser, root)->program.count = parser->scratchCount - mark;
+    node(parser, root)->program.first = closeList(parser, mark);
+    parser->ast->root = root;
+    return root;
+}
+
+// Make the program node for functions parsed elsewhere (in source order).
+NodeIndex makeProgram(Parser *parser, const NodeIndex *functions, uint32_t count) {
+    uint32_t mark = openList(parser);
+    for (uint32_t i = 0; i < count; i++) {
+        pushChild(parser, functions[i]);
+    }
+    return closeProgram(parser, mark);
+}
+
+NodeIndex parseFunction(Parser* parser) {
+    if (currentType(parser) != KEYW_INT) {
         reportError(parser, "Function must start with 'int'");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
     consume(parser, KEYW_INT, "Expected 'int'");
 
-    if (currentToken(parser)->type != TOKEN_IDENTIFIER) {
+    if (currentType(parser) != TOKEN_IDENTIFIER) {
         reportError(parser, "Expected function name identifier");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
-    char *funcName = strdup(currentToken(parser)->value);
+    Symbol funcName = currentSymbol(parser);
     consume(parser, TOKEN_IDENTIFIER, "After function name");
 
     consume(parser, TOKEN_OPAREN, "Expected '(' after function name");
     consume(parser, TOKEN_CPAREN, "Expected ')' after '('");
 
-    ASTNode *body = parseBlock(parser);
+    NodeIndex body = parseBlock(parser);
     if (!body) {
         reportError(parser, "Invalid function body");
-        return NULL;
+        return NO_NODE;
     }
 
-    ASTNode *node = newASTNode(AST_FUNCTION);
-    node->function.name = funcName;
-    node->function.body = body;
-    return node;
+    NodeIndex func = newASTNode(parser, AST_FUNCTION);
+    node(parser, func)->function.name = funcName;
+    node(parser, func)->function.body = body;
+    return func;
 }
 
-ASTNode *parseBlock(Parser* parser) {
+NodeIndex parseBlock(Parser* parser) {
     // TODO: implement: https://stackoverflow.com/questions/22419790/c-error-expected-expression-before-int#22420796
-    if (currentToken(parser)->type != TOKEN_OBRACE) {
+    if (currentType(parser) != TOKEN_OBRACE) {
         reportError(parser, "Expected '{' to start block");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
     consume(parser, TOKEN_OBRACE, "Start block");
 
-    ASTNode *node = newASTNode(AST_BLOCK);
-    node->block.statements = NULL;
-    node->block.statementCount = 0;
-
-    while (currentToken(parser)->type != TOKEN_CBRACE &&
-        currentToken(parser)->type != TOKEN_EOF) {
-        ASTNode *stmt = parseStatement(parser);
+    uint32_t statements = openList(parser);
+    while (currentType(parser) != TOKEN_CBRACE &&
+        currentType(parser) != TOKEN_EOF) {
+        NodeIndex stmt = parseStatement(parser);
         if (stmt) {
-            node->block.statementCount++;
-            node->block.statements = realloc(node->block.statements, sizeof(ASTNode *) * node->block.statementCount);
-            node->block.statements[node->block.statementCount - 1] = stmt;
+            pushChild(parser, stmt);
         } else {
             skip(parser);
         }
     }
 
-    if (currentToken(parser)->type == TOKEN_CBRACE) {
+    if (currentType(parser) == TOKEN_CBRACE) {
         consume(parser, TOKEN_CBRACE, "End block");
     } else {
         reportError(parser, "Expected '}' to end block");
     }
-    return node;
-}
-
-ASTNode *parseStatement(Parser* parser) {
-    // Empty statement???
-    if (currentToken(parser)->type == TOKEN_SEMICOL) {
-        ASTNode *node = newASTNode(AST_STATEMENT);
-        node->statement.retn = NULL;
-        node->statement.declaration = NULL;
-        node->statement.expression = NULL;
-        node->statement.ifstatement = NULL;
-        node->statement.forstatement = NULL;
-        node->statement.compound = NULL;
-        return node;
-    }
-    if (currentToken(parser)->type == KEYW_RETURN) {
-        ASTNode *node = newASTNode(AST_STATEMENT);
-        node->statement.retn = parseReturn(parser);
-        node->statement.declaration = NULL;
-        node->statement.expression = NULL;
-        node->statement.ifstatement = NULL;
-        node->statement.forstatement = NULL;
-        node->statement.compound = NULL;
+
+    NodeIndex block = newASTNode(parser, AST_BLOCK);
+    node(parser, block)->block.count = parser->scratchCount - statements;
+    node(parser, block)->block.first = closeList(parser, statements);
+    return block;
+}
+
+// Stands in for ';' and for statements whose parse already reported an
+// error and recovered, so the enclosing block doesn't skip again.
+static NodeIndex emptyStatement(Parser *parser) {
+    return newASTNode(parser, AST_BLOCK);
+}
+
+NodeIndex parseStatement(Parser* parser) {
+    // Empty statement:
+    if (currentType(parser) == TOKEN_SEMICOL) {
+        consume(parser, TOKEN_SEMICOL, "Empty statement");
+        return emptyStatement(parser);
+    }
+    if (currentType(parser) == KEYW_RETURN) {
+        NodeIndex stmt = parseReturn(parser);
         if (parser->errorFlag) {
             skip(parser);
-            return NULL;
+            return NO_NODE;
         }
-        if (currentToken(parser)->type != TOKEN_SEMICOL) {
+        if (currentType(parser) != TOKEN_SEMICOL) {
             reportError(parser, "Expected ';' after expression");
             skip(parser);
-            return NULL;
+            return NO_NODE;
         }
         consume(parser, TOKEN_SEMICOL, "After expression");
-        return node;
-    }
-    if (currentToken(parser)->type == KEYW_INT) {
-        ASTNode *node = newASTNode(AST_STATEMENT);
-        node->statement.retn = NULL;
-        node->statement.declaration = parseDeclaration(parser);
-        node->statement.expression = NULL;
-        node->statement.ifstatement = NULL;
-        node->statement.forstatement = NULL;
-        node->statement.compound = NULL;
-        return node;
-    }
-    if (currentToken(parser)->type == KEYW_IF
-        || currentToken(parser)->type == KEYW_ELSE) {
-        ASTNode *node = newASTNode(AST_STATEMENT);
-        node->statement.retn = NULL;
-        node->statement.declaration = NULL;
-        node->statement.expression = NULL;
-        node->statement.ifstatement = parseIf(parser);
-        node->statement.forstatement = NULL;
-        node->statement.compound = NULL;
-        return node;
-    }
-    if (currentToken(parser)->type == KEYW_FOR) {
-        ASTNode *node = newASTNode(AST_STATEMENT);
-        node->statement.retn = NULL;
-        node->statement.declaration = NULL;
-        node->statement.expression = NULL;
-        node->statement.ifstatement = NULL;
-        node->statement.forstatement = parseFor(parser);
-        node->statement.compound = NULL;
-        return node;
-    }
-    if (currentToken(parser)->type == TOKEN_OBRACE) {
-        ASTNode *node = newASTNode(AST_STATEMENT);
-        node->statement.retn = NULL;
-        node->statement.declaration = NULL;
-        node->statement.expression = NULL;
-        node->statement.ifstatement = NULL;
-        node->statement.forstatement = NULL;
-        node->statement.compound = parseBlock(parser);
-        return node;
-    }
-    ASTNode *node = newASTNode(AST_STATEMENT);
-    node->statement.retn = NULL;
-    node->statement.declaration = NULL;
-    node->statement.expression = parseExpression(parser, 0);
-    if (node->statement.expression == NULL) {
-        reportError(parser, "Invalid expression");
-        skip(parser);
-        return NULL;
-    }
-    if (currentToken(parser)->type != TOKEN_SEMICOL) {
-        reportError(parser, "Expected ';' at end of statement");
-        skip(parser);
-        return NULL;
+        return stmt;
+    }
+
+    NodeIndex stmt = NO_NODE;
+    if (currentType(parser) == KEYW_INT) {
+        stmt = parseDeclaration(parser);
+    } else if (currentType(parser) == KEYW_IF
+        || currentType(parser) == KEYW_ELSE) {
+        stmt = parseIf(parser);
+    } else if (currentType(parser) == KEYW_FOR) {
+        stmt = parseFor(parser);
+    } else if (currentType(parser) == TOKEN_OBRACE) {
+        stmt = parseBlock(parser);
+    } else {
+        stmt = parseExpression(parser, 0);
+        if (stmt == NO_NODE) {
+            reportError(parser, "Invalid expression");
+            skip(parser);
+            return NO_NODE;
+        }
+        if (currentType(parser) != TOKEN_SEMICOL) {
+            reportError(parser, "Expected ';' at end of statement");
+            skip(parser);
+            return NO_NODE;
+        }
+        consume(parser, TOKEN_SEMICOL, "After expression");
+        return stmt;
     }
-    consume(parser, TOKEN_SEMICOL, "After expression");
-    return node;
+    return stmt ? stmt : emptyStatement(parser);
 }
 
-ASTNode *parseIf(Parser* parser) {
-    if (currentToken(parser)->type != KEYW_IF) {
+NodeIndex parseIf(Parser* parser) {
+    if (currentType(parser) != KEYW_IF) {
         reportError(parser, "Expected if");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
 
     consume(parser, KEYW_IF, "Start of conditional");
     consume(parser, TOKEN_OPAREN, "Expected parenthesis");
-    ASTNode* node = newASTNode(AST_IF);
-    node->ifstmt.condition = parseExpression(parser, 0);
+    NodeIndex condition = parseExpression(parser, 0);
     consume(parser, TOKEN_CPAREN, "Expected end of expression.");
-    node->ifstmt.body = currentToken(parser)->type == TOKEN_OBRACE ? 
+    NodeIndex body = currentType(parser) == TOKEN_OBRACE ? 
                             parseBlock(parser) : parseStatement(parser);
-    if (currentToken(parser)->type == KEYW_ELSE) {
+    NodeIndex elsestmt = NO_NODE;
+    if (currentType(parser) == KEYW_ELSE) {
         consume(parser, KEYW_ELSE, "Start of else statement");
-        node->ifstmt.elsestmt = currentToken(parser)->type == TOKEN_OBRACE ? 
+        elsestmt = currentType(parser) == TOKEN_OBRACE ? 
                                 parseBlock(parser) : parseStatement(parser);
     }
-    return node;
+    NodeIndex stmt = newASTNode(parser, AST_IF);
+    node(parser, stmt)->ifstmt.condition = condition;
+    node(parser, stmt)->ifstmt.body = body;
+    node(parser, stmt)->ifstmt.elsestmt = elsestmt;
+    return stmt;
 }
 
-ASTNode *parseFor(Parser* parser) {
-    if (currentToken(parser)->type != KEYW_FOR) {
+NodeIndex parseFor(Parser* parser) {
+    if (currentType(parser) != KEYW_FOR) {
         reportError(parser, "Expected for");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
 
     consume(parser, KEYW_FOR, "Start of for loop");
     consume(parser, TOKEN_OPAREN, "Expected parenthesis");
-    ASTNode* node = newASTNode(AST_FOR);
-    node->forstmt.init = parseExpression(parser, 0);
+    NodeIndex parts[4];
+    parts[0] = parseExpression(parser, 0);
     consume(parser, TOKEN_SEMICOL, "Expected semicolon for initial condition");
-    node->forstmt.condition = parseExpression(parser, 0);
+    parts[1] = parseExpression(parser, 0);
     consume(parser, TOKEN_SEMICOL, "Expected semicolon for repeating condition");
-    node->forstmt.postexp = parseExpression(parser, 0);
+    parts[2] = parseExpression(parser, 0);
     consume(parser, TOKEN_CPAREN, "Expected end of expression.");
-    node->forstmt.body = currentToken(parser)->type == TOKEN_OBRACE ? 
+    parts[3] = currentType(parser) == TOKEN_OBRACE ? 
                             parseBlock(parser) : parseStatement(parser);
-    return node;
+    NodeIndex stmt = newASTNode(parser, AST_FOR);
+    node(parser, stmt)->forstmt.parts = addList(parser, parts, 4);
+    return stmt;
 }
 
-ASTNode *parseReturn(Parser* parser) {
+NodeIndex parseReturn(Parser* parser) {
     consume(parser, KEYW_RETURN, "Return statement start");
-    ASTNode* node = newASTNode(AST_RETURN);
-    node->retn.expression = parseExpression(parser, 0);
-    return node;
+    NodeIndex expression = parseExpression(parser, 0);
+    NodeIndex stmt = newASTNode(parser, AST_RETURN);
+    node(parser, stmt)->retn.expression = expression;
+    return stmt;
 }
 
-ASTNode *parseDeclaration(Parser* parser) {
-    if (currentToken(parser)->type != KEYW_INT) {
+NodeIndex parseDeclaration(Parser* parser) {
+    if (currentType(parser) != KEYW_INT) {
         reportError(parser, "Expected int keyword in declaration");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
     consume(parser, KEYW_INT, "Declaration start");
-    ASTNode *node = newASTNode(AST_DECL);
-    node->decl.identifier = parseIdentifier(parser);
-    if (currentToken(parser)->type == OP_ASSN) {
+    Symbol name = NO_SYMBOL;
+    if (currentType(parser) != TOKEN_IDENTIFIER) {
+        reportError(parser, "Expected identifier");
+        skip(parser);
+    } else {
+        name = currentSymbol(parser);
+        consume(parser, TOKEN_IDENTIFIER, "After identifier");
+    }
+    NodeIndex initializer = NO_NODE;
+    if (currentType(parser) == OP_ASSN) {
         consume(parser, OP_ASSN, "Start of assignment");
-        node->decl.initializer = parseExpression(parser, 0);
-        node->decl.type = "int";
-        consume(parser, TOKEN_SEMICOL, "End of declaration");
-        return node;
-    }
-    if (currentToken(parser)->type == TOKEN_SEMICOL) {
-        node->decl.initializer = NULL;
-        node->decl.type = "int";
-        consume(parser, TOKEN_SEMICOL, "End of declaration");
-        return node;
-    }
-    if (   currentToken(parser)->type != OP_ASSN
-        && currentToken(parser)->type != TOKEN_SEMICOL) {
+        initializer = parseExpression(parser, 0);
+    } else if (currentType(parser) != TOKEN_SEMICOL) {
         reportError(parser, "Expected assignment or declaration");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
-    return NULL;
+    consume(parser, TOKEN_SEMICOL, "End of declaration");
+    NodeIndex decl = newASTNode(parser, AST_DECL);
+    node(parser, decl)->decl.name = name;
+    node(parser, decl)->decl.initializer = initializer;
+    return decl;
 }
 
-ASTNode *parseExpression(Parser* parser, int minPrecedence) {
-    if (   currentToken(parser)->type != OP_COMPL
-        && currentToken(parser)->type != OP_NEGATION
-        && currentToken(parser)->type != OP_NEGATIONL
-        && currentToken(parser)->type != LITERAL_INT
-        && currentToken(parser)->type != TOKEN_OPAREN
-        && currentToken(parser)->type != TOKEN_IDENTIFIER
-        && currentToken(parser)->type != TOKEN_SEMICOL
-        && currentToken(parser)->type != OP_INC
-        && currentToken(parser)->type != OP_DEC) { 
+// Pending work in parseExpression. Each frame stands for a call the
+// recursive-descent version would have had on the C stack.
+typedef enum {
+    FRAME_EXPR,         // An expression at minPrec; left is its value so far
+    FRAME_PAREN,        // Waiting for the inside of '(' ... ')'
+    FRAME_UNARY,        // Waiting for the operand of op
+    FRAME_BINARY,       // Waiting for the right operand of node
+    FRAME_ASSIGN,       // Same, but the enclosing expression ends after it
+    FRAME_TERN_TRUE,    // Waiting for the branch after '?'
+    FRAME_TERN_FALSE,   // Waiting for the branch after ':'
+} FrameKind;
+
+typedef struct {
+    FrameKind kind;
+    TokenType op;
+    int minPrec;
+    NodeIndex left;     // EXPR: left operand; TERN_*: the condition
+    NodeIndex node;     // BINARY/ASSIGN: operator node; TERN_FALSE: true branch
+} ExprFrame;
+
+typedef struct {
+    ExprFrame *frames;
+    int count;
+    int capacity;
+    MemCounter *mem;
+    ExprFrame inline_[32];
+} ExprStack;
+
+static ExprFrame *pushFrame(ExprStack *stack, FrameKind kind) {
+    if (stack->count == stack->capacity) {
+        stack->capacity *= 2;
+        if (stack->frames == stack->inline_) {
+            stack->frames = malloc(stack->capacity * sizeof(ExprFrame));
+            memcpy(stack->frames, stack->inline_, sizeof(stack->inline_));
+            countAlloc(stack->mem, stack->capacity * sizeof(ExprFrame));
+        } else {
+            stack->frames = realloc(stack->frames, stack->capacity * sizeof(ExprFrame));
+            countResize(stack->mem, stack->capacity / 2 * sizeof(ExprFrame), stack->capacity * sizeof(ExprFrame));
+        }
+    }
+    ExprFrame *frame = &stack->frames[stack->count++];
+    frame->kind = kind;
+    frame->left = NO_NODE;
+    frame->node = NO_NODE;
+    return frame;
+}
+
+static NodeIndex makeUnary(Parser *parser, TokenType op, NodeIndex operand, int isPostfix) {
+    NodeIndex unary = newASTNode(parser, AST_UNARY);
+    node(parser, unary)->unary.op = op;
+    node(parser, unary)->unary.operand = operand;
+    node(parser, unary)->isPostfix = isPostfix;
+    return unary;
+}
+
+// Pratt parser driven by an explicit stack, so nesting depth costs heap
+// frames rather than C stack. Binary operators bind by precedence();
+// '=' and '?:' are right associative and end the expression they start.
+NodeIndex parseExpression(Parser* parser, int minPrecedence) {
+    ExprStack stack;
+    stack.frames = stack.inline_;
+    stack.count = 0;
+    stack.capacity = sizeof(stack.inline_) / sizeof(stack.inline_[0]);
+    stack.mem = &parser->mem;
+
+    NodeIndex value = NO_NODE;
+    pushFrame(&stack, FRAME_EXPR)->minPrec = minPrecedence;
+
+startExpression:
+    if (   currentType(parser) != OP_COMPL
+        && currentType(parser) != OP_NEGATION
+        && currentType(parser) != OP_NEGATIONL
+        && currentType(parser) != LITERAL_INT
+        && currentType(parser) != TOKEN_OPAREN
+        && currentType(parser) != TOKEN_IDENTIFIER
+        && currentType(parser) != TOKEN_SEMICOL
+        && currentType(parser) != OP_INC
+        && currentType(parser) != OP_DEC) { 
         reportError(parser, "Invalid expression provided");
         skip(parser);
-        return NULL;
+        value = NO_NODE;
+        goto endExpression;
+    }
+
+startFactor:
+    // Parenthesized expressions become the inner expression itself; unary
+    // operators wrap the factor or identifier they apply to.
+    switch (currentType(parser)) {
+        case TOKEN_OPAREN:
+            consume(parser, TOKEN_OPAREN, "At expression start");
+            pushFrame(&stack, FRAME_PAREN);
+            pushFrame(&stack, FRAME_EXPR)->minPrec = 0;
+            goto startExpression;
+        case OP_INC:
+        case OP_DEC: {
+            TokenType op = parseUnary(parser);
+            value = makeUnary(parser, op, parseIdentifier(parser), 0);
+            break;
+        }
+        case OP_NEGATION:
+        case OP_NEGATIONL:
+        case OP_COMPL:
+            pushFrame(&stack, FRAME_UNARY)->op = parseUnary(parser);
+            goto startFactor;
+        case LITERAL_INT:
+            value = parseConstant(parser);
+            break;
+        case TOKEN_IDENTIFIER:
+            value = parseIdentifier(parser);
+            if (currentType(parser) == OP_INC 
+                || currentType(parser) == OP_DEC) {
+                value = makeUnary(parser, parseUnary(parser), value, 1);
+            }
+            break;
+        default:
+            reportError(parser, "Invalid factor");
+            value = NO_NODE;
+            break;
     }
 
-    ASTNode *left = parseFactor(parser);
-    if (currentToken(parser)->type == TOKEN_SEMICOL) {
-        return left;
+endFactor:
+    if (stack.frames[stack.count - 1].kind == FRAME_UNARY) {
+        ExprFrame *frame = &stack.frames[--stack.count];
+        value = makeUnary(parser, frame->op, value, 0);
+        goto endFactor;
     }
+    stack.frames[stack.count - 1].left = value;
 
-    while (currentToken(parser)) {
-        Token *op = currentToken(parser);
-        int opPrec = precedence(op->type);
+operatorLoop: {
+        ExprFrame *frame = &stack.frames[stack.count - 1];
+        TokenType op = currentType(parser);
+        int opPrec = precedence(op);
 
         // Stop if operator's precedence is below the minimum,
         // or if we hit a closing parenthesis or semicolon.
-        if (opPrec < minPrecedence || op->type == TOKEN_CPAREN || op->type == TOKEN_SEMICOL)
-            break;
+        if (opPrec < frame->minPrec || op == TOKEN_CPAREN || op == TOKEN_SEMICOL) {
+            value = frame->left;
+            goto endExpression;
+        }
 
-        if (op->type == OP_Q) {
+        if (op == OP_Q) {
             consume(parser, OP_Q, "Start of expression");
-            ASTNode *trueC = parseExpression(parser, 0);
-            if (!currentToken(parser) || currentToken(parser)->type != OP_COLON) {
+            NodeIndex condition = frame->left;
+            ExprFrame *tern = pushFrame(&stack, FRAME_TERN_TRUE);
+            tern->left = condition;
+            tern->minPrec = opPrec;
+            pushFrame(&stack, FRAME_EXPR)->minPrec = 0;
+            goto startExpression;
+        }
+
+        NodeIndex left = frame->left;
+        NodeIndex binNode = parseBinary(parser);
+        if (binNode == NO_NODE) {
+            value = left;
+            goto endExpression;
+        }
+        node(parser, binNode)->binary.left = left;
+        // Assignment is right associative: its right side takes everything
+        // of equal or higher precedence.
+        ExprFrame *pending = pushFrame(&stack, op == OP_ASSN ? FRAME_ASSIGN : FRAME_BINARY);
+        pending->node = binNode;
+        pushFrame(&stack, FRAME_EXPR)->minPrec = op == OP_ASSN ? opPrec : opPrec + 1;
+        goto startExpression;
+    }
+
+endExpression:
+    // The expression on top of the stack is done; hand value to whatever
+    // was waiting for it.
+    stack.count--;
+    if (stack.count == 0) {
+        if (stack.frames != stack.inline_) {
+            free(stack.frames);
+            countFree(stack.mem, stack.capacity * sizeof(ExprFrame));
+        }
+        return value;
+    }
+    ExprFrame *frame = &stack.frames[stack.count - 1];
+    switch (frame->kind) {
+        case FRAME_PAREN:
+            stack.count--;
+            consume(parser, TOKEN_CPAREN, "Expected closing bracket at end of expression");
+            goto endFactor;
+        case FRAME_BINARY:
+            node(parser, frame->node)->binary.right = value;
+            value = frame->node;
+            stack.count--;
+            stack.frames[stack.count - 1].left = value;
+            goto operatorLoop;
+        case FRAME_ASSIGN:
+            node(parser, frame->node)->binary.right = value;
+            value = frame->node;
+            stack.count--;
+            goto endExpression;
+        case FRAME_TERN_TRUE: {
+            NodeIndex condition = frame->left;
+            int opPrec = frame->minPrec;
+            stack.count--;
+            if (currentType(parser) != OP_COLON) {
                 reportError(parser, "Expected ':' in conditional expression");
                 skip(parser);
-                return NULL;
+                value = NO_NODE;
+                goto endExpression;
             }
             consume(parser, OP_COLON, "Middle of expression");
-            ASTNode *ternNode = newASTNode(AST_TERNARY);
-            ASTNode *falseC = parseExpression(parser, opPrec);
-            if (currentToken(parser)->type == OP_ASSN) {
+            ExprFrame *tern = pushFrame(&stack, FRAME_TERN_FALSE);
+            tern->left = condition;
+            tern->node = value;
+            pushFrame(&stack, FRAME_EXPR)->minPrec = opPrec;
+            goto startExpression;
+        }
+        case FRAME_TERN_FALSE: {
+            NodeIndex condition = frame->left;
+            NodeIndex trueC = frame->node;
+            stack.count--;
+            if (currentType(parser) == OP_ASSN) {
                 reportError(parser, "Cannot assign to expression");
                 skip(parser);
-                return NULL;
+                value = NO_NODE;
+                goto endExpression;
             }
-            ternNode->ternary.condition = left;
-            ternNode->ternary.trueCond = trueC;
-            ternNode->ternary.falseCond = falseC;
-            return ternNode;
-        }   
-        if (op->type == OP_ASSN) {
-            ASTNode *binNode = parseBinary(parser);
-            ASTNode *right = parseExpression(parser, opPrec);
-            binNode->binary.left = left;
-            binNode->binary.right = right;
-            return binNode;
-        }
-        
-        // Parse right-hand side expression with higher precedence.
-        ASTNode *binNode = parseBinary(parser);
-        if (binNode == NULL) break;
-        ASTNode *right = parseExpression(parser, opPrec + 1);
-        binNode->binary.left = left;
-        binNode->binary.right = right;
-        left = binNode;
-    }
-
-    return left;
-}
-
-ASTNode *parseFactor(Parser* parser) {
-    ASTNode *node = newASTNode(AST_FACTOR);
-    node->factor.expression = NULL;
-    node->factor.unary = NULL;
-    node->factor.constant = NULL;
-    node->factor.identifier = NULL;
-    node->factor.factor = NULL;
-    if (currentToken(parser)->type == TOKEN_OPAREN) {
-        consume(parser, TOKEN_OPAREN, "At expression start");
-        node->factor.expression = parseExpression(parser, 0);
-        consume(parser, TOKEN_CPAREN, "Expected closing bracket at end of expression");
-        return node;
-    }
-    if (currentToken(parser)->type == OP_INC
-        || currentToken(parser)->type == OP_DEC) {
-        node->factor.unary = parseUnary(parser);
-        node->factor.identifier = parseIdentifier(parser);
-        return node;
-    }
-    if (currentToken(parser)->type == OP_NEGATION
-        || currentToken(parser)->type == OP_NEGATIONL
-        || currentToken(parser)->type == OP_COMPL) {
-        node->factor.unary = parseUnary(parser);
-        node->factor.factor = parseFactor(parser);
-        return node;
-    }   
-    if (currentToken(parser)->type == LITERAL_INT) {
-        node->factor.constant = parseConstant(parser);
-        return node;
-    }
-    if (currentToken(parser)->type == TOKEN_IDENTIFIER) {
-        node->factor.identifier = parseIdentifier(parser);
-        if (currentToken(parser)->type == OP_INC 
-            || currentToken(parser)->type == OP_DEC) {
-            node->factor.unary = parseUnary(parser);
-            node->factor.unary->unary.isPostfix = 1;
+            NodeIndex ternNode = newASTNode(parser, AST_TERNARY);
+            node(parser, ternNode)->ternary.condition = condition;
+            node(parser, ternNode)->ternary.trueCond = trueC;
+            node(parser, ternNode)->ternary.falseCond = value;
+            value = ternNode;
+            goto endExpression;
         }
-        return node;
+        default:
+            // FRAME_EXPR and FRAME_UNARY never wait on a whole expression.
+            goto endExpression;
     }
-    reportError(parser, "Invalid factor");
-    return NULL;
 }
 
-ASTNode *parseUnary(Parser* parser) {
-    if (currentToken(parser)->type != OP_COMPL 
-        && currentToken(parser)->type != OP_NEGATION
-        && currentToken(parser)->type != OP_NEGATIONL
-        && currentToken(parser)->type != OP_INC
-        && currentToken(parser)->type != OP_DEC) {
+// Consume a unary operator and return its token type.
+TokenType parseUnary(Parser* parser) {
+    if (currentType(parser) != OP_COMPL 
+        && currentType(parser) != OP_NEGATION
+        && currentType(parser) != OP_NEGATIONL
+        && currentType(parser) != OP_INC
+        && currentType(parser) != OP_DEC) {
         reportError(parser, "Expected operator in expression");
         skip(parser);
-        return NULL;
+        return TOKEN_INVALID;
     }
-    ASTNode *node = newASTNode(AST_UNARY);
-    node->unary.value = strdup(currentToken(parser)->value);
-    node->unary.isPostfix = 0;
-    consume(parser, currentToken(parser)->type, "Before expression");
-    return node;
+    TokenType op = currentType(parser);
+    consume(parser, currentType(parser), "Before expression");
+    return op;
 }
 
-ASTNode *parseBinary(Parser* parser) {
-    if (currentToken(parser)->type < OP_NEGATION || currentToken(parser)->type >= TOKEN_EOF) {
+// Consume a binary operator; the caller fills in the operands.
+NodeIndex parseBinary(Parser* parser) {
+    if (currentType(parser) < OP_NEGATION || currentType(parser) >= TOKEN_EOF) {
         reportError(parser, "Expected operator in expression");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
-    if (currentToken(parser)->type == OP_COLON || currentToken(parser)->type == OP_Q) {
-        return NULL;
+    if (currentType(parser) == OP_COLON || currentType(parser) == OP_Q) {
+        return NO_NODE;
     }
-    ASTNode *node = newASTNode(AST_BINARY);
-    node->binary.value = strdup(currentToken(parser)->value);
-    consume(parser, currentToken(parser)->type, "Before expression");
-    return node;
+    NodeIndex binary = newASTNode(parser, AST_BINARY);
+    node(parser, binary)->binary.op = currentType(parser);
+    consume(parser, currentType(parser), "Before expression");
+    return binary;
 }
 
-ASTNode *parseConstant(Parser* parser) {
-    if (currentToken(parser)->type != LITERAL_INT) {
+NodeIndex parseConstant(Parser* parser) {
+    if (currentType(parser) != LITERAL_INT) {
         reportError(parser, "Expected constant (number) in expression");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
-    ASTNode *node = newASTNode(AST_CONSTANT);
-    node->constant.value = strdup(currentToken(parser)->value);
+    NodeIndex constant = newASTNode(parser, AST_CONSTANT);
+    node(parser, constant)->constant.value = currentSymbol(parser);
     consume(parser, LITERAL_INT, "After constant");
-    return node;
+    return constant;
 }
 
-ASTNode *parseIdentifier(Parser *parser) {
-    if (currentToken(parser)->type != TOKEN_IDENTIFIER) {
+NodeIndex parseIdentifier(Parser *parser) {
+    if (currentType(parser) != TOKEN_IDENTIFIER) {
         reportError(parser, "Expected identifier");
         skip(parser);
-        return NULL;
+        return NO_NODE;
     }
-    ASTNode *node = newASTNode(AST_IDENTIFIER);
-    node->identifier.value = strdup(currentToken(parser)->value);
+    NodeIndex identifier = newASTNode(parser, AST_IDENTIFIER);
+    node(parser, identifier)->identifier.symbol = currentSymbol(parser);
     consume(parser, TOKEN_IDENTIFIER, "After identifier");
-    if (currentToken(parser)->type == OP_INC) {
-
-    }
-    return node;
-
+    return identifier;
 }
 
 /* --- AST Printing for Debug --- */
-void printAST(ASTNode *node, int indent) {
+static void printIndent(int indent) {
     for (int i = 0; i < indent; i++) printf("  ");
     printf("|__");
+}
+
+void printAST(const AST *ast, NodeIndex index, const Interner *interner, int indent) {
+    printIndent(indent);
+    if (index == NO_NODE) {
+        printf("(none)\n");
+        return;
+    }
+    const ASTNode *node = astNode(ast, index);
     switch (node->type) {
         case AST_PROGRAM:
             printf("Program:\n");
-            for (int i = 0; i < node->program.functionCount; i++) {
-                printAST(node->program.functions[i], indent + 1);
+            for (uint32_t i = 0; i < node->program.count; i++) {
+                printAST(ast, ast->lists[node->program.first + i], interner, indent + 1);
             }
             break;
         case AST_FUNCTION:
-            printf("Function: %s\n", node->function.name);
-            printAST(node->function.body, indent + 1);
+            printf("Function: %s\n", symbolName(interner, node->function.name));
+            printAST(ast, node->function.body, interner, indent + 1);
             break;
         case AST_BLOCK:
             printf("Block:\n");
-            for (int i = 0; i < node->block.statementCount; i++) {
-                printAST(node->block.statements[i], indent + 1);
-            }
-            break;
-        case AST_STATEMENT:
-            printf("Statement:\n");
-            if (node->statement.expression != NULL ) printAST(node->statement.expression, indent + 1);
-            if (node->statement.declaration != NULL ) printAST(node->statement.declaration, indent + 1);
-            if (node->statement.compound != NULL ) printAST(node->statement.compound, indent + 1);
-            if (node->statement.retn != NULL ) printAST(node->statement.retn, indent + 1);
-            if (node->statement.ifstatement != NULL ) printAST(node->statement.ifstatement, indent + 1);
-            break;
-        case AST_EXPRESSION:
-            printf("Terms:\n");
-            if (node->expression.term != NULL) {
-                printAST(node->expression.term, indent);
-            } 
-            if (node->expression.binary != NULL) {
-                printAST(node->expression.binary, indent + 1);
+            for (uint32_t i = 0; i < node->block.count; i++) {
+                printAST(ast, ast->lists[node->block.first + i], interner, indent + 1);
             }
             break;
         case AST_DECL:
             printf("Declaration:\n");
-            for (int i = 0; i < indent + 1; i++) printf("  ");
-            printf("|__");
-            if (node->decl.type != NULL ) {
-                printf("Type: %s\n", node->decl.type);
-            }
-            if (node->decl.identifier != NULL) {
-                printAST(node->decl.identifier, indent + 1);
-            }
-            if (node->decl.initializer != NULL) {
-                for (int i = 0; i < indent + 1; i++) printf("  ");
-                printf("|__");
+            printIndent(indent + 1);
+            printf("Type: int\n");
+            printIndent(indent + 1);
+            printf("Name: %s\n", node->decl.name != NO_SYMBOL ? symbolName(interner, node->decl.name) : "?");
+            if (node->decl.initializer != NO_NODE) {
+                printIndent(indent + 1);
                 printf("Initialized as:\n");
-                printAST(node->decl.initializer, indent + 2);
+                printAST(ast, node->decl.initializer, interner, indent + 2);
             }
             break;
         case AST_RETURN:
             printf("Returns:\n");
-            if (node->retn.expression != NULL) {
-                printAST(node->retn.expression, indent + 1);
+            if (node->retn.expression != NO_NODE) {
+                printAST(ast, node->retn.expression, interner, indent + 1);
             }
             break;
         case AST_IF:
             printf("Condition:\n");
-            printAST(node->ifstmt.condition, indent + 1);
-            for (int i = 0; i < indent; i++) printf("  ");
-            printf("|__");
+            printAST(ast, node->ifstmt.condition, interner, indent + 1);
+            printIndent(indent);
             printf("Body:\n");
-            printAST(node->ifstmt.body, indent + 1);
-            if (node->ifstmt.elsestmt != NULL) {
-                for (int i = 0; i < indent; i++) printf("  ");
-                printf("|__");
+            printAST(ast, node->ifstmt.body, interner, indent + 1);
+            if (node->ifstmt.elsestmt != NO_NODE) {
+                printIndent(indent);
                 printf("Else:\n");
-                printAST(node->ifstmt.elsestmt, indent + 1);
+                printAST(ast, node->ifstmt.elsestmt, interner, indent + 1);
             }
             break;
+        case AST_FOR: {
+            static const char *labels[] = { "Init:", "Condition:", "Post:", "Body:" };
+            printf("For:\n");
+            for (int i = 0; i < 4; i++) {
+                printIndent(indent + 1);
+                printf("%s\n", labels[i]);
+                printAST(ast, ast->lists[node->forstmt.parts + i], interner, indent + 2);
+            }
+            break;
+        }
         case AST_TERNARY:
             printf("Condition:\n");
-            printAST(node->ternary.condition, indent + 1);
-            for (int i = 0; i < indent; i++) printf("  ");
-            printf("|__");
+            printAST(ast, node->ternary.condition, interner, indent + 1);
+            printIndent(indent);
             printf("True condition:\n");
-            printAST(node->ternary.trueCond, indent + 1);
-            for (int i = 0; i < indent; i++) printf("  ");
-            printf("|__");
+            printAST(ast, node->ternary.trueCond, interner, indent + 1);
+            printIndent(indent);
             printf("False condition:\n");
-            printAST(node->ternary.falseCond, indent + 1);
-            break;
-        case AST_FACTOR:
-            printf("Factor:\n");
-            if (node->factor.expression != NULL) printAST(node->factor.expression, indent + 1); 
-            if (node->factor.unary != NULL) printAST(node->factor.unary, indent + 1);   
-            if (node->factor.constant != NULL) printAST(node->factor.constant, indent + 1); 
-            if (node->factor.factor != NULL) printAST(node->factor.factor, indent + 1);
-            if (node->factor.identifier != NULL) printAST(node->factor.identifier, indent + 1);
+            printAST(ast, node->ternary.falseCond, interner, indent + 1);
             break;
         case AST_CONSTANT:
-            printf("Constant: %s\n", node->constant.value);
+            printf("Constant: %s\n", symbolName(interner, node->constant.value));
             break;
         case AST_UNARY:
-            printf("Operator: %s\n", node->unary.value);
-            for (int i = 0; i < indent; i++) printf("  ");
-            printf("|__");
-            printf("Postfix?: %s\n", node->unary.isPostfix ? "true" : "false");
+            printf("Operator: %s\n", tokenText(node->unary.op));
+            printIndent(indent);
+            printf("Postfix?: %s\n", node->isPostfix ? "true" : "false");
+            printAST(ast, node->unary.operand, interner, indent + 1);
             break;
         case AST_BINARY:
             printf("Left:\n");
-            printAST(node->binary.left, indent + 1);
-            for (int i = 0; i < indent + 1; i++) printf("  ");
-            printf("|__");
-            printf("Operator:%s\n", node->binary.value);
-            for (int i = 0; i < indent; i++) printf("  ");
-            printf("|__");
+            printAST(ast, node->binary.left, interner, indent + 1);
+            printIndent(indent + 1);
+            printf("Operator:%s\n", tokenText(node->binary.op));
+            printIndent(indent);
             printf("Right:\n");
-            printAST(node->binary.right, indent + 1);
+            printAST(ast, node->binary.right, interner, indent + 1);
             break;
         case AST_IDENTIFIER:
-            printf("Name: %s\n", node->identifier.value);
+            printf("Name: %s\n", symbolName(interner, node->identifier.symbol));
             break;
         default:
             printf("Unknown AST Node\n");
@@ -634,96 +930,3 @@ void printAST(ASTNode *node, int indent) {
             break;
         }
 }
-
-// Recursively free the AST nodes.
-void freeAST(ASTNode *node) {
-    if (!node)
-        return;
-    switch (node->type) {
-        case AST_PROGRAM:
-            for (int i = 0; i < node->program.functionCount; i++) {
-                freeAST(node->program.functions[i]);
-            }
-            free(node->program.functions);
-            break;
-        case AST_FUNCTION:
-            free(node->function.name);
-            freeAST(node->function.body);
-            break;
-        case AST_BLOCK:
-            for (int i = 0; i < node->block.statementCount; i++) {
-                freeAST(node->block.statements[i]);
-            }
-            free(node->block.statements);
-            break;
-        case AST_STATEMENT:
-            freeAST(node->statement.expression);
-            break;
-        case AST_FACTOR:
-            if ( node->factor.expression != NULL ) {
-                freeAST(node->factor.expression);
-                node->factor.expression = NULL;
-            }
-            if ( node->factor.unary != NULL ) {
-                freeAST(node->factor.unary);
-                node->factor.unary = NULL;
-            }
-            if ( node->factor.constant != NULL ) {
-                freeAST(node->factor.constant);
-                node->factor.constant = NULL;
-            }
-            if ( node->factor.factor != NULL ) {
-                freeAST(node->factor.factor);
-                node->factor.factor = NULL;
-            }
-            break;
-        case AST_UNARY:
-            if (node->unary.value != NULL) {
-                free(node->unary.value);
-                node->unary.value = NULL;
-            }
-            break;
-        case AST_CONSTANT:
-            if (node->unary.value != NULL) {
-                free(node->constant.value);
-                node->constant.value = NULL;
-            }
-            break;
-        case AST_BINARY:
-            if (node->binary.left != NULL) {
-                freeAST(node->binary.left);
-                node->binary.left = NULL;
-            }
-            if (node->binary.right != NULL) {
-                freeAST(node->binary.right);
-                node->binary.right = NULL;
-            }
-            if (node->binary.value != NULL) {
-                free(node->binary.value);
-                node->binary.value = NULL;
-            }
-            break;
-        default:
-            break;
-    }
-    free(node);
-}
-
-// Free the array of tokens.
-void freeTokens(Token **tokens, int tokenCount) {
-    for (int i = 0; i < tokenCount; i++) {
-        if (tokens[i]->type == KEYW_INT
-        ||  tokens[i]->type == KEYW_RETURN
-        ||  tokens[i]->type == LITERAL_INT
-        ||  tokens[i]->type == TOKEN_IDENTIFIER) {
-            free(tokens[i]->value);
-            tokens[i]->value = NULL;
-        }
-        if (tokens[i] != NULL) {
-            free(tokens[i]);
-            tokens[i] = NULL;
-        }
-    }
-    free(tokens);
-}
-
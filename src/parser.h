@@ -1,11 +1,11 @@
-#include "lexer.h"
+#include <stdio.h>
+#include "context.h"
 #ifndef PARSER_H
 #define PARSER_H
 typedef enum {
     AST_PROGRAM,
     AST_FUNCTION,
     AST_BLOCK,
-    AST_STATEMENT,
     AST_DECL,
     AST_IF,
     AST_FOR,
@@ -15,147 +15,154 @@ typedef enum {
     AST_CONT,
     AST_TERNARY,
     AST_RETURN,
-    AST_EXPRESSION,
     AST_CONSTANT,
     AST_UNARY,
     AST_BINARY,
     AST_IDENTIFIER,
-    AST_FACTOR
 } ASTNodeType;
 
-typedef struct ASTNode {
-    ASTNodeType type;
+// Nodes refer to each other by their index in AST.nodes. Index 0 is never
+// used, so a zeroed field means "no child".
+typedef uint32_t NodeIndex;
+#define NO_NODE 0
+
+// One 16-byte AST node. Variable-length children live out of line in
+// AST.lists, and names and literals are interned Symbols.
+typedef struct {
+    uint8_t type;       // ASTNodeType
+    uint8_t isPostfix;  // AST_UNARY: operator follows its operand
     union {
-        // AST_PROGRAM: list of functions
+        // AST_PROGRAM: functions are lists[first .. first + count)
         struct {
-            struct ASTNode **functions;
-            int functionCount;
+            uint32_t first;
+            uint32_t count;
         } program;
 
         // AST_FUNCTION: function name and block
         struct {
-            char* name;
-            struct ASTNode *body;
+            Symbol name;
+            NodeIndex body;
         } function;
 
-        // AST_BLOCK: list of statements
+        // AST_BLOCK: statements are lists[first .. first + count)
         struct {
-            struct ASTNode **statements;
-            int statementCount;
+            uint32_t first;
+            uint32_t count;
         } block;
 
-        // AST_STATEMENT: simple expression
-        struct {
-            struct ASTNode *expression;
-            struct ASTNode *declaration;
-            struct ASTNode *ifstatement;
-            struct ASTNode *forstatement;
-            struct ASTNode *compound;
-            struct ASTNode *retn;
-        } statement;
-
         // AST_RETURN: return statement 
         struct {
-            struct ASTNode *expression;
+            NodeIndex expression;
         } retn;
 
         // AST_IF: if statement
         struct {
-            struct ASTNode *condition; 
-            struct ASTNode *body;
-            struct ASTNode *elsestmt;
+            NodeIndex condition; 
+            NodeIndex body;
+            NodeIndex elsestmt;
         } ifstmt;
 
-        // AST_FOR: for statement
+        // AST_FOR: lists[parts .. parts + 4) = init, condition, postexp, body
         struct {
-            struct ASTNode *init; 
-            struct ASTNode *condition;
-            struct ASTNode *postexp;
-            struct ASTNode *body;
+            uint32_t parts;
         } forstmt;
 
         // AST_TERNARY: ternary conditional
         struct {
-            struct ASTNode *condition; 
-            struct ASTNode *trueCond;
-            struct ASTNode *falseCond;
+            NodeIndex condition; 
+            NodeIndex trueCond;
+            NodeIndex falseCond;
         } ternary;
 
-        // AST_DECL: declaration statement
+        // AST_DECL: declaration of an int variable
         struct {
-            char *type;
-            struct ASTNode *identifier;
-            struct ASTNode *initializer;
+            Symbol name;
+            NodeIndex initializer;
         } decl;
 
-        // AST_EXPRESSION: contains two more sub-expressions
-        struct {
-            struct ASTNode *term;
-            struct ASTNode *binary;
-        } expression;
-
-        // AST_FACTOR: contains a sub-expression, an operator, a factor, or a constant
-        struct {
-            struct ASTNode *expression;
-            struct ASTNode *factor;
-            struct ASTNode *unary;
-            struct ASTNode *constant;
-            struct ASTNode *identifier;
-        } factor;
-
-        // AST_CONSTANT: numeric constant (as string)
+        // AST_CONSTANT: numeric constant (as interned text)
         struct {
-            char *value;
+            Symbol value;
         } constant;
 
-        // AST_UNARY: unary symbol (as string)
+        // AST_UNARY: operator token applied to an operand
         struct {
-            char *value;
-            int isPostfix;
+            TokenType op;
+            NodeIndex operand;
         } unary;
 
         // AST_IDENTIFIER: identifier 
         struct {
-            char *value;
+            Symbol symbol;
         } identifier;
 
-        // AST_BINARY: binary operator (as string)
+        // AST_BINARY: binary operator token
         struct {
-            struct ASTNode *left;
-            char *value;
-            struct ASTNode *right;
+            NodeIndex left;
+            TokenType op;
+            NodeIndex right;
         } binary;
-
     };
 } ASTNode;
 
+// A whole program's tree, stored flat.
+typedef struct {
+    ASTNode *nodes;
+    uint32_t nodeCount;
+    uint32_t nodeCapacity;
+    NodeIndex *lists;       // Child lists referenced by program/block/for nodes
+    uint32_t listCount;
+    uint32_t listCapacity;
+    NodeIndex root;
+    void *mapping;          // Set when nodes and lists point into a mapped cache file
+    size_t mappingSize;
+    MemCounter nodeMem;     // Node array, including the AST struct itself
+    MemCounter listMem;
+} AST;
+
+static inline ASTNode *astNode(const AST *ast, NodeIndex index) {
+    return &ast->nodes[index];
+}
+
 typedef struct {
-    Token **tokens;    // Array of Token pointers
-    int currentIndex;  // Current index into the tokens array
-    int tokenCount;    // Total number of tokens in the array
+    CompilerContext *ctx; // Compile this parser belongs to
+    AST *ast;          // Tree the parser appends to
+    TokenStream *stream; // Pulls tokens on demand; NULL to read from tokens
+    TokenBuffer *tokens; // Fully lexed token buffer
+    int currentIndex;  // Current index into the token buffer
+    int tokenEnd;      // Tokens from here on read as EOF
     int errorFlag;     // Flag for error state
+    FILE *errors;      // Where parse errors are printed; NULL to only set errorFlag
+    NodeIndex *scratch; // Children of the lists still being parsed
+    uint32_t scratchCount;
+    uint32_t scratchCapacity;
+    MemCounter mem;    // Scratch stack and spilled expression stacks
 } Parser;
 
-ASTNode *newASTNode(ASTNodeType type);
-ASTNode *parseProgram(Parser* parser);
-ASTNode *parseFunction(Parser* parser);
-ASTNode *parseBlock(Parser* parser);
-ASTNode *parseStatement(Parser* parser);
-ASTNode *parseIf(Parser* parser);
-ASTNode *parseFor(Parser* parser);
-ASTNode *parseReturn(Parser* parser);
-ASTNode *parseDeclaration(Parser* parser);
-ASTNode *parseExpression(Parser* parser, int precedence);
-ASTNode *parseUnary(Parser* parser);
-ASTNode *parseBinary(Parser* parser);
-ASTNode *parseFactor(Parser* parser);
-ASTNode *parseConstant(Parser* parser);
-ASTNode *parseIdentifier(Parser *parser);
+void initParser(Parser *parser, CompilerContext *ctx, AST *ast);
+void freeParser(Parser *parser);
+AST *createAST();
+void freeAST(AST *ast);
+NodeIndex appendAST(AST *into, const AST *from);
+NodeIndex newASTNode(Parser *parser, ASTNodeType type);
+NodeIndex makeProgram(Parser *parser, const NodeIndex *functions, uint32_t count);
+NodeIndex parseProgram(Parser* parser);
+NodeIndex parseFunction(Parser* parser);
+NodeIndex parseBlock(Parser* parser);
+NodeIndex parseStatement(Parser* parser);
+NodeIndex parseIf(Parser* parser);
+NodeIndex parseFor(Parser* parser);
+NodeIndex parseReturn(Parser* parser);
+NodeIndex parseDeclaration(Parser* parser);
+NodeIndex parseExpression(Parser* parser, int precedence);
+TokenType parseUnary(Parser* parser);
+NodeIndex parseBinary(Parser* parser);
+NodeIndex parseConstant(Parser* parser);
+NodeIndex parseIdentifier(Parser *parser);
 int precedence(TokenType type);
 void consume(Parser* parser, TokenType expected, const char *errorMsg);
-Token *currentToken(Parser *parser);
-Token *nextToken(Parser *parser);
-void printAST(ASTNode *node, int indent);
-void freeAST(ASTNode *node);
-void freeTokens(Token **tokens, int tokenCount);
+TokenType currentType(Parser *parser);
+Token currentToken(Parser *parser);
+void advance(Parser *parser);
+void printAST(const AST *ast, NodeIndex node, const Interner *interner, int indent);
 #endif
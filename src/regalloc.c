@@ -0,0 +1,438 @@
+#include <stdlib.h>
+#include <string.h>
+#include "regalloc.h"
+
+#define BITS_PER_WORD (8 * sizeof(unsigned long))
+#define ALL_REGISTERS ((1u << REG_COUNT) - 1)
+// Deeper loops than this weigh the same.
+#define MAX_LOOP_DEPTH 6
+
+static void *resizeArray(void *array, size_t oldCount, size_t newCount, size_t itemSize, MemCounter *mem) {
+    countResize(mem, oldCount * itemSize, newCount * itemSize);
+    return realloc(array, newCount * itemSize);
+}
+
+static size_t grownCapacity(size_t capacity, size_t needed) {
+    return needed > 2 * capacity ? needed : 2 * capacity;
+}
+
+void initRegAllocator(RegAllocator *ra) {
+    memset(ra, 0, sizeof(RegAllocator));
+    ra->allowedRegisters = ALL_REGISTERS;
+}
+
+void freeRegAllocator(RegAllocator *ra) {
+    free(ra->location);
+    free(ra->immediate);
+    free(ra->intervals);
+    free(ra->globalIndex);
+    free(ra->globals);
+    free(ra->defBlock);
+    free(ra->reachable);
+    free(ra->blockStart);
+    free(ra->blockEnd);
+    free(ra->worklist);
+    free(ra->depth);
+    free(ra->divides);
+    free(ra->sets);
+    memset(ra, 0, sizeof(RegAllocator));
+}
+
+// Make the per-vreg, per-block and per-position arrays big enough for func.
+static void reserveAllocator(RegAllocator *ra, const IRFunction *func) {
+    size_t vregs = func->vregCount ? (size_t)func->vregCount : 1;
+    if (vregs > ra->vregCapacity) {
+        size_t old = ra->vregCapacity;
+        size_t capacity = grownCapacity(old, vregs);
+        ra->location = resizeArray(ra->location, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->immediate = resizeArray(ra->immediate, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->intervals = resizeArray(ra->intervals, old, capacity, sizeof(LiveInterval), &ra->mem);
+        ra->globalIndex = resizeArray(ra->globalIndex, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->globals = resizeArray(ra->globals, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->defBlock = resizeArray(ra->defBlock, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->vregCapacity = capacity;
+    }
+    if (func->blockCount > ra->blockCapacity) {
+        size_t old = ra->blockCapacity;
+        size_t capacity = grownCapacity(old, func->blockCount);
+        ra->reachable = resizeArray(ra->reachable, old, capacity, sizeof(uint8_t), &ra->mem);
+        ra->blockStart = resizeArray(ra->blockStart, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->blockEnd = resizeArray(ra->blockEnd, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->worklist = resizeArray(ra->worklist, old, capacity, sizeof(uint32_t), &ra->mem);
+        ra->blockCapacity = capacity;
+    }
+    // One more position than there are instructions, for the end of the
+    // last loop.
+    if (func->codeCount + 1 > ra->positionCapacity) {
+        size_t old = ra->positionCapacity;
+        size_t capacity = grownCapacity(old, func->codeCount + 1);
+        ra->depth = resizeArray(ra->depth, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->divides = resizeArray(ra->divides, old, capacity, sizeof(int32_t), &ra->mem);
+        ra->positionCapacity = capacity;
+    }
+}
+
+// Blocks only reached from code after a return still have predecessors,
+// so reachability is found from the entry rather than from pred counts.
+static void findReachable(RegAllocator *ra, const IRFunction *func) {
+    memset(ra->reachable, 0, func->blockCount);
+    size_t top = 0;
+    ra->reachable[0] = 1;
+    ra->worklist[top++] = 0;
+    while (top) {
+        int32_t succ[2];
+        blockSuccessors(func, ra->worklist[--top], succ);
+        for (int i = 0; i < 2; i++) {
+            if (succ[i] >= 0 && !ra->reachable[succ[i]]) {
+                ra->reachable[succ[i]] = 1;
+                ra->worklist[top++] = (uint32_t)succ[i];
+            }
+        }
+    }
+}
+
+// Number the reachable instructions in layout order, note where the
+// divides are, and work out how deeply each position is nested in loops.
+// Lowering lays a loop's blocks out between its head and the jump back,
+// so an edge to a block that doesn't come later closes a loop.
+static void numberPositions(RegAllocator *ra, const IRFunction *func, size_t *divideCount) {
+    int32_t position = 0;
+    *divideCount = 0;
+    for (size_t i = 0; i < func->layoutCount; i++) {
+        uint32_t b = func->layout[i];
+        const IRBlock *block = &func->blocks[b];
+        if (!ra->reachable[b]) {
+            continue;
+        }
+        ra->blockStart[b] = position;
+        for (uint32_t k = 0; k < block->count; k++, position++) {
+            if (func->code[block->first + k].op == IR_DIV) {
+                ra->divides[(*divideCount)++] = position;
+            }
+        }
+        ra->blockEnd[b] = position - 1;
+    }
+
+    memset(ra->depth, 0, (position + 1) * sizeof(int32_t));
+    for (size_t b = 0; b < func->blockCount; b++) {
+        if (!ra->reachable[b]) {
+            continue;
+        }
+        int32_t succ[2];
+        blockSuccessors(func, (uint32_t)b, succ);
+        for (int i = 0; i < 2; i++) {
+            if (succ[i] >= 0 && ra->blockStart[succ[i]] <= ra->blockStart[b]) {
+                ra->depth[ra->blockStart[succ[i]]]++;
+                ra->depth[ra->blockEnd[b] + 1]--;
+            }
+        }
+    }
+    for (int32_t p = 1; p < position; p++) {
+        ra->depth[p] += ra->depth[p - 1];
+    }
+}
+
+// A vreg written once, by IR_CONST, holds that value wherever it's read,
+// so it needs no register. idivl has no immediate form, so divisors are
+// left to the allocator.
+static void findConstants(RegAllocator *ra, const IRFunction *func) {
+    const int32_t notConstant = IMMEDIATE - 1;
+    for (int32_t v = 0; v < func->vregCount; v++) {
+        ra->location[v] = NO_LOCATION;
+    }
+    for (size_t b = 0; b < func->blockCount; b++) {
+        const IRBlock *block = &func->blocks[b];
+        if (!ra->reachable[b]) {
+            continue;
+        }
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            if (instr->op == IR_DIV) {
+                ra->location[instr->b] = notConstant;
+            }
+            if (instr->dst == NO_VREG) {
+                continue;
+            }
+            if (instr->op == IR_CONST && ra->location[instr->dst] == NO_LOCATION) {
+                ra->location[instr->dst] = IMMEDIATE;
+                ra->immediate[instr->dst] = instr->imm;
+            } else {
+                ra->location[instr->dst] = notConstant;
+            }
+        }
+    }
+    for (int32_t v = 0; v < func->vregCount; v++) {
+        if (ra->location[v] == notConstant) {
+            ra->location[v] = NO_LOCATION;
+        }
+    }
+}
+
+// Only vregs read in a block that doesn't write them first can be live
+// across blocks. Temporaries never are, so numbering just these keeps the
+// liveness sets small.
+static size_t findGlobals(RegAllocator *ra, const IRFunction *func) {
+    size_t count = 0;
+    for (int32_t v = 0; v < func->vregCount; v++) {
+        ra->globalIndex[v] = -1;
+        ra->defBlock[v] = -1;
+    }
+    for (size_t i = 0; i < func->layoutCount; i++) {
+        int32_t b = (int32_t)func->layout[i];
+        const IRBlock *block = &func->blocks[b];
+        if (!ra->reachable[b]) {
+            continue;
+        }
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            int32_t operands[2] = { instr->a, instr->b };
+            for (int j = 0; j < 2; j++) {
+                int32_t v = operands[j];
+                if (v != NO_VREG && ra->defBlock[v] != b && ra->globalIndex[v] < 0) {
+                    ra->globalIndex[v] = (int32_t)count;
+                    ra->globals[count++] = v;
+                }
+            }
+            if (instr->dst != NO_VREG) {
+                ra->defBlock[instr->dst] = b;
+            }
+        }
+    }
+    return count;
+}
+
+static void setBit(unsigned long *set, int32_t bit) {
+    set[bit / BITS_PER_WORD] |= 1UL << (bit % BITS_PER_WORD);
+}
+
+// Backward dataflow over the globals: live out is the union of the
+// successors' live in, and live in is what's read before being written
+// plus whatever is live out and not written.
+static void computeLiveness(RegAllocator *ra, const IRFunction *func, size_t words) {
+    size_t needed = func->blockCount * 4 * words;
+    if (needed > ra->setCapacity) {
+        size_t capacity = grownCapacity(ra->setCapacity, needed);
+        ra->sets = resizeArray(ra->sets, ra->setCapacity, capacity, sizeof(unsigned long), &ra->mem);
+        ra->setCapacity = capacity;
+    }
+    memset(ra->sets, 0, needed * sizeof(unsigned long));
+    for (size_t b = 0; b < func->blockCount; b++) {
+        const IRBlock *block = &func->blocks[b];
+        unsigned long *used = &ra->sets[(b * 4 + 2) * words];
+        unsigned long *written = used + words;
+        if (!ra->reachable[b]) {
+            continue;
+        }
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            int32_t operands[2] = { instr->a, instr->b };
+            for (int j = 0; j < 2; j++) {
+                int32_t v = operands[j];
+                if (v == NO_VREG || ra->globalIndex[v] < 0) {
+                    continue;
+                }
+                int32_t g = ra->globalIndex[v];
+                if (!((written[g / BITS_PER_WORD] >> (g % BITS_PER_WORD)) & 1)) {
+                    setBit(used, g);
+                }
+            }
+            if (instr->dst != NO_VREG && ra->globalIndex[instr->dst] >= 0) {
+                setBit(written, ra->globalIndex[instr->dst]);
+            }
+        }
+    }
+
+    // Reverse layout order visits most successors first.
+    for (int changed = 1; changed; ) {
+        changed = 0;
+        for (size_t i = func->layoutCount; i-- > 0; ) {
+            uint32_t b = func->layout[i];
+            if (!ra->reachable[b]) {
+                continue;
+            }
+            unsigned long *in = &ra->sets[b * 4 * words];
+            unsigned long *out = in + words;
+            const unsigned long *used = out + words;
+            const unsigned long *written = used + words;
+            int32_t succ[2];
+            blockSuccessors(func, b, succ);
+            for (size_t w = 0; w < words; w++) {
+                unsigned long live = 0;
+                for (int s = 0; s < 2; s++) {
+                    if (succ[s] >= 0) {
+                        live |= ra->sets[succ[s] * 4 * words + w];
+                    }
+                }
+                out[w] = live;
+                unsigned long liveIn = used[w] | (live & ~written[w]);
+                changed |= liveIn != in[w];
+                in[w] = liveIn;
+            }
+        }
+    }
+}
+
+static void extendInterval(LiveInterval *interval, int32_t position) {
+    if (interval->start < 0 || position < interval->start) {
+        interval->start = position;
+    }
+    if (position > interval->end) {
+        interval->end = position;
+    }
+}
+
+// Extend the intervals of the globals in set to position.
+static void extendLive(RegAllocator *ra, const unsigned long *set, size_t words, int32_t position) {
+    for (size_t w = 0; w < words; w++) {
+        for (unsigned long bits = set[w]; bits; bits &= bits - 1) {
+            int32_t g = (int32_t)(w * BITS_PER_WORD) + __builtin_ctzl(bits);
+            extendInterval(&ra->intervals[ra->globals[g]], position);
+        }
+    }
+}
+
+// One interval per vreg that needs a location, from its first to its last
+// live position. Returns how many there are, packed at the front of
+// intervals.
+static size_t buildIntervals(RegAllocator *ra, const IRFunction *func, size_t words) {
+    for (int32_t v = 0; v < func->vregCount; v++) {
+        ra->intervals[v].vreg = v;
+        ra->intervals[v].start = -1;
+        ra->intervals[v].end = -1;
+        ra->intervals[v].weight = 0;
+    }
+    for (size_t b = 0; b < func->blockCount; b++) {
+        const IRBlock *block = &func->blocks[b];
+        if (!ra->reachable[b]) {
+            continue;
+        }
+        for (uint32_t k = 0; k < block->count; k++) {
+            const IRInstr *instr = &func->code[block->first + k];
+            int32_t position = ra->blockStart[b] + (int32_t)k;
+            int32_t depth = ra->depth[position];
+            uint64_t weight = 1ull << (3 * (depth < MAX_LOOP_DEPTH ? depth : MAX_LOOP_DEPTH));
+            int32_t vregs[3] = { instr->a, instr->b, instr->dst };
+            for (int j = 0; j < 3; j++) {
+                if (vregs[j] != NO_VREG) {
+                    extendInterval(&ra->intervals[vregs[j]], position);
+                    ra->intervals[vregs[j]].weight += weight;
+                }
+            }
+        }
+        if (words) {
+            const unsigned long *in = &ra->sets[b * 4 * words];
+            extendLive(ra, in, words, ra->blockStart[b]);
+            extendLive(ra, in + words, words, ra->blockEnd[b]);
+        }
+    }
+    size_t count = 0;
+    for (int32_t v = 0; v < func->vregCount; v++) {
+        if (ra->intervals[v].start >= 0 && ra->location[v] != IMMEDIATE) {
+            ra->intervals[count++] = ra->intervals[v];
+        }
+    }
+    return count;
+}
+
+static int compareIntervals(const void *left, const void *right) {
+    const LiveInterval *a = left;
+    const LiveInterval *b = right;
+    if (a->start != b->start) {
+        return a->start < b->start ? -1 : 1;
+    }
+    return a->vreg < b->vreg ? -1 : a->vreg > b->vreg;
+}
+
+// idivl overwrites %edx, so nothing live across a divide can be kept there.
+// A divide's own result can, since it's only stored after the idivl.
+static int crossesDivide(const int32_t *divides, size_t count, const LiveInterval *interval) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (divides[middle] <= interval->start) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low < count && divides[low] <= interval->end;
+}
+
+// Which of two intervals to spill: the one with less use per position
+// it covers, so a long-lived variable gives way to the temporaries that
+// could share its register, or else the one that ends later.
+static int spillFirst(const LiveInterval *a, const LiveInterval *b) {
+    double aDensity = (double)a->weight / (a->end - a->start + 1);
+    double bDensity = (double)b->weight / (b->end - b->start + 1);
+    return aDensity < bDensity || (aDensity == bDensity && a->end > b->end);
+}
+
+void allocateRegisters(RegAllocator *ra, const IRFunction *func) {
+    reserveAllocator(ra, func);
+    findReachable(ra, func);
+    size_t divideCount;
+    numberPositions(ra, func, &divideCount);
+    findConstants(ra, func);
+    size_t globalCount = findGlobals(ra, func);
+    size_t words = (globalCount + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    if (words) {
+        computeLiveness(ra, func, words);
+    }
+    size_t count = buildIntervals(ra, func, words);
+    qsort(ra->intervals, count, sizeof(LiveInterval), compareIntervals);
+
+    // active holds the intervals that have a register, at most one each.
+    size_t active[REG_COUNT];
+    size_t activeCount = 0;
+    unsigned freeRegisters = ra->allowedRegisters;
+    ra->usedRegisters = 0;
+    ra->spillSlots = 0;
+    for (size_t i = 0; i < count; i++) {
+        const LiveInterval *current = &ra->intervals[i];
+        for (size_t j = 0; j < activeCount; ) {
+            const LiveInterval *done = &ra->intervals[active[j]];
+            if (done->end < current->start) {
+                freeRegisters |= 1u << ra->location[done->vreg];
+                active[j] = active[--activeCount];
+            } else {
+                j++;
+            }
+        }
+
+        unsigned allowed = ra->allowedRegisters;
+        if (crossesDivide(ra->divides, divideCount, current)) {
+            allowed &= ~(1u << REG_EDX);
+        }
+        if (freeRegisters & allowed) {
+            // Lowest first, so the caller-saved registers go before the
+            // ones the prologue has to save.
+            int reg = __builtin_ctz(freeRegisters & allowed);
+            ra->location[current->vreg] = reg;
+            freeRegisters &= ~(1u << reg);
+            ra->usedRegisters |= 1u << reg;
+            active[activeCount++] = i;
+            continue;
+        }
+
+        // Everything's taken: spill whichever is cheapest to keep in memory,
+        // taking its register if that isn't the current interval.
+        size_t victim = activeCount;
+        for (size_t j = 0; j < activeCount; j++) {
+            const LiveInterval *candidate = &ra->intervals[active[j]];
+            if (!(allowed & (1u << ra->location[candidate->vreg]))) {
+                continue;
+            }
+            if (victim == activeCount || spillFirst(candidate, &ra->intervals[active[victim]])) {
+                victim = j;
+            }
+        }
+        if (victim < activeCount && spillFirst(&ra->intervals[active[victim]], current)) {
+            int32_t spilled = ra->intervals[active[victim]].vreg;
+            ra->location[current->vreg] = ra->location[spilled];
+            ra->location[spilled] = REG_COUNT + ra->spillSlots++;
+            active[victim] = i;
+        } else {
+            ra->location[current->vreg] = REG_COUNT + ra->spillSlots++;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include "ir.h"
+#include "data.h"
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+// Linear-scan register allocation (Poletto and Sarkar, 1999). Each vreg
+// gets one live interval over the function's instructions in layout
+// order; intervals are handed registers in order of their start, and when
+// none is free the one with the least weight is spilled to the stack.
+
+// Registers handed out to vregs. %eax is kept back as the scratch register
+// for instruction selection (and for cdq/idivl and setcc).
+typedef enum {
+    REG_ECX,
+    REG_EDX,
+    REG_EBX,    // %ebx, %esi and %edi are callee-saved
+    REG_ESI,
+    REG_EDI,
+    REG_COUNT,
+} Register;
+
+#define CALLEE_SAVED ((1u << REG_EBX) | (1u << REG_ESI) | (1u << REG_EDI))
+
+// A location below REG_COUNT is a register; from REG_COUNT up it's a
+// stack slot, numbered from 0. Vregs that only ever hold one constant
+// aren't given either, and are used as immediates instead.
+#define NO_LOCATION (-1)
+#define IMMEDIATE (-2)
+#define SPILL_SLOT(location) ((location) - REG_COUNT)
+
+typedef struct {
+    int32_t vreg;
+    int32_t start, end;     // First and last position where the vreg is live
+    uint64_t weight;        // Reads and writes, scaled up by loop depth
+} LiveInterval;
+
+typedef struct {
+    int32_t *location;      // Per vreg, or NO_LOCATION if it's never live
+    int32_t *immediate;     // Per vreg: the value, if location is IMMEDIATE
+    uint8_t *reachable;     // Per block; the rest aren't emitted
+    int spillSlots;
+    unsigned usedRegisters; // Bit (1 << reg) for each register handed out
+    unsigned allowedRegisters; // Registers it may hand out; all unless changed
+
+    // Scratch space, kept from one function to the next
+    LiveInterval *intervals;
+    int32_t *globalIndex;   // Per vreg: index into globals, or -1
+    int32_t *globals;       // Vregs read in some block other than where they're set
+    int32_t *defBlock;      // Per vreg: block of the latest write seen
+    size_t vregCapacity;
+    int32_t *blockStart;    // Per block: first and last position
+    int32_t *blockEnd;
+    uint32_t *worklist;
+    size_t blockCapacity;
+    int32_t *depth;         // Per position: loop nesting
+    int32_t *divides;       // Positions of IR_DIV, which clobbers %edx
+    size_t positionCapacity;
+    unsigned long *sets;    // Per block: live in, live out, used, written
+    size_t setCapacity;
+    MemCounter mem;
+} RegAllocator;
+
+void initRegAllocator(RegAllocator *ra);
+void freeRegAllocator(RegAllocator *ra);
+// Compute liveness for func and give every vreg that's live in a
+// reachable block a register or a stack slot.
+void allocateRegisters(RegAllocator *ra, const IRFunction *func);
+#endif
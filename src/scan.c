@@ -0,0 +1,190 @@
+#include "scan.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static inline int isSpace(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+static inline int isDigit(unsigned char c) {
+    return (unsigned char)(c - '0') <= 9;
+}
+
+static inline int isAlnum(unsigned char c) {
+    return isDigit(c) || (unsigned char)((c | 0x20) - 'a') <= 'z' - 'a';
+}
+
+// Scalar versions; also finish off the last partial block of the SIMD ones.
+static size_t spaceScalar(const char *s, size_t pos, size_t len, int *lines) {
+    while (pos < len && isSpace(s[pos])) {
+        if (s[pos] == '\n') {
+            (*lines)++;
+        }
+        pos++;
+    }
+    return pos;
+}
+
+static size_t digitsScalar(const char *s, size_t pos, size_t len) {
+    while (pos < len && isDigit(s[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+static size_t alnumScalar(const char *s, size_t pos, size_t len) {
+    while (pos < len && isAlnum(s[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+#ifdef SCAN_X86
+/* --- SSE2: 16 bytes per step (always available on x86-64) --- */
+
+// Lanes where lo <= x <= hi, as an unsigned compare after biasing by lo.
+static inline __m128i inRange16(__m128i x, char lo, char hi) {
+    __m128i d = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(hi - lo)), d);
+}
+
+static inline unsigned spaceMask16(__m128i x) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), inRange16(x, '\t', '\r'));
+    return _mm_movemask_epi8(m);
+}
+
+static inline unsigned alnumMask16(__m128i x) {
+    __m128i alpha = inRange16(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+    return _mm_movemask_epi8(_mm_or_si128(inRange16(x, '0', '9'), alpha));
+}
+
+static size_t spaceSSE2(const char *s, size_t pos, size_t len, int *lines) {
+    while (pos + 16 <= len) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + pos));
+        unsigned ws = spaceMask16(x);
+        unsigned nl = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+        if (ws != 0xFFFF) {
+            unsigned run = __builtin_ctz(~ws);
+            *lines += __builtin_popcount(nl & ((1u << run) - 1));
+            return pos + run;
+        }
+        *lines += __builtin_popcount(nl);
+        pos += 16;
+    }
+    return spaceScalar(s, pos, len, lines);
+}
+
+static size_t digitsSSE2(const char *s, size_t pos, size_t len) {
+    while (pos + 16 <= len) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + pos));
+        unsigned m = _mm_movemask_epi8(inRange16(x, '0', '9'));
+        if (m != 0xFFFF) {
+            return pos + __builtin_ctz(~m);
+        }
+        pos += 16;
+    }
+    return digitsScalar(s, pos, len);
+}
+
+static size_t alnumSSE2(const char *s, size_t pos, size_t len) {
+    while (pos + 16 <= len) {
+        unsigned m = alnumMask16(_mm_loadu_si128((const __m128i *)(s + pos)));
+        if (m != 0xFFFF) {
+            return pos + __builtin_ctz(~m);
+        }
+        pos += 16;
+    }
+    return alnumScalar(s, pos, len);
+}
+
+/* --- AVX2: 32 bytes per step, only used if the CPU reports it --- */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i inRange32(__m256i x, char lo, char hi) {
+    __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(hi - lo)), d);
+}
+
+AVX2 static size_t spaceAVX2(const char *s, size_t pos, size_t len, int *lines) {
+    while (pos + 32 <= len) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + pos));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), inRange32(x, '\t', '\r'));
+        unsigned ws = _mm256_movemask_epi8(m);
+        unsigned nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+        if (ws != 0xFFFFFFFFu) {
+            unsigned run = __builtin_ctz(~ws);
+            *lines += __builtin_popcount(nl & ((1u << run) - 1));
+            return pos + run;
+        }
+        *lines += __builtin_popcount(nl);
+        pos += 32;
+    }
+    return spaceSSE2(s, pos, len, lines);
+}
+
+AVX2 static size_t digitsAVX2(const char *s, size_t pos, size_t len) {
+    while (pos + 32 <= len) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + pos));
+        unsigned m = _mm256_movemask_epi8(inRange32(x, '0', '9'));
+        if (m != 0xFFFFFFFFu) {
+            return pos + __builtin_ctz(~m);
+        }
+        pos += 32;
+    }
+    return digitsSSE2(s, pos, len);
+}
+
+AVX2 static size_t alnumAVX2(const char *s, size_t pos, size_t len) {
+    while (pos + 32 <= len) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + pos));
+        __m256i alpha = inRange32(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z');
+        unsigned m = _mm256_movemask_epi8(_mm256_or_si256(inRange32(x, '0', '9'), alpha));
+        if (m != 0xFFFFFFFFu) {
+            return pos + __builtin_ctz(~m);
+        }
+        pos += 32;
+    }
+    return alnumSSE2(s, pos, len);
+}
+#undef AVX2
+#endif
+
+/* --- Runtime dispatch --- */
+typedef size_t (*SpaceScanner)(const char *, size_t, size_t, int *);
+typedef size_t (*ClassScanner)(const char *, size_t, size_t);
+
+// Start out scalar; on x86 a constructor picks the SIMD versions before
+// main runs, so the pointers are settled before any parser thread starts.
+static SpaceScanner spaceImpl = spaceScalar;
+static ClassScanner digitsImpl = digitsScalar;
+static ClassScanner alnumImpl = alnumScalar;
+
+#ifdef SCAN_X86
+__attribute__((constructor)) static void selectScanners(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        spaceImpl = spaceAVX2;
+        digitsImpl = digitsAVX2;
+        alnumImpl = alnumAVX2;
+    } else {
+        spaceImpl = spaceSSE2;
+        digitsImpl = digitsSSE2;
+        alnumImpl = alnumSSE2;
+    }
+}
+#endif
+
+size_t scanSpace(const char *s, size_t pos, size_t len, int *lines) {
+    return spaceImpl(s, pos, len, lines);
+}
+
+size_t scanDigits(const char *s, size_t pos, size_t len) {
+    return digitsImpl(s, pos, len);
+}
+
+size_t scanAlnum(const char *s, size_t pos, size_t len) {
+    return alnumImpl(s, pos, len);
+}
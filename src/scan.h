@@ -0,0 +1,16 @@
+#ifndef SCAN_H
+#define SCAN_H
+#include <stddef.h>
+
+// Character-class scanners used by the lexer. Each returns the position of
+// the first byte at or after pos (and before len) that is not in the class.
+// SSE2/AVX2 versions are picked at runtime, with a scalar fallback.
+
+// Whitespace as isspace() sees it in the C locale; adds newlines to *lines.
+size_t scanSpace(const char *s, size_t pos, size_t len, int *lines);
+// [0-9]
+size_t scanDigits(const char *s, size_t pos, size_t len);
+// [0-9A-Za-z]
+size_t scanAlnum(const char *s, size_t pos, size_t len);
+
+#endif
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <time.h>
+#ifndef BENCH_H
+#define BENCH_H
+
+// Shared by the benchmarks under tests/. Each one is a standalone
+// program run by make bench, against the compiler built with -O2.
+
+static inline double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Repeat a timed run until about minTotal seconds have gone by (at least
+// once) and keep the fastest; one run alone is too noisy on small inputs.
+#define BEST_OF(best, minTotal, run) do {                       \
+        double benchStart = seconds();                          \
+        (best) = 1e30;                                          \
+        do {                                                    \
+            double runStart = seconds();                        \
+            run;                                                \
+            double runTime = seconds() - runStart;              \
+            if (runTime < (best)) {                             \
+                (best) = runTime;                               \
+            }                                                   \
+        } while (seconds() - benchStart < (minTotal));          \
+    } while (0)
+
+#endif
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "cache.h"
+#include "generator.h"
+#include "bench.h"
+
+// Cold vs. warm compiles with the AST cache. Cold starts from an empty
+// cache directory, so it lexes, parses and writes the entry; warm maps
+// the entry written by the run before. Both are timed for the front end
+// alone and for the front end plus code generation.
+
+// Empty the cache directory.
+static void clearCache(const char *dir) {
+    DIR *entries = opendir(dir);
+    struct dirent *entry;
+    char path[1024];
+    while (entries && (entry = readdir(entries))) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    if (entries) {
+        closedir(entries);
+    }
+}
+
+// One compile the way c3 does it without --jobs; returns 1 on a cache hit.
+static int compile(const char *path, const char *cacheDir, int generate) {
+    CompilerContext *ctx = createContext(path);
+    ctx->cacheDir = cacheDir;
+    AST *ast = loadCachedAST(ctx);
+    TokenStream *stream = NULL;
+    if (!ast) {
+        stream = createTokenStream(ctx->source, ctx->interner);
+        Parser parser;
+        initParser(&parser, ctx, createAST());
+        parser.stream = stream;
+        ast = parser.ast;
+        parseProgram(&parser);
+        freeParser(&parser);
+        storeCachedAST(ctx, ast);
+    }
+    if (generate) {
+        CodeGenerator generator;
+        initCodeGenerator(&generator, ctx);
+        generateX86(&generator, ast);
+        freeCodeGenerator(&generator);
+    }
+    int hit = ctx->cacheHits;
+    freeAST(ast);
+    freeTokenStream(stream);
+    freeContext(ctx);
+    return hit;
+}
+
+static int writeSource(const char *path, int functions) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to create benchmark source");
+        return 1;
+    }
+    for (int i = 0; i < functions; i++) {
+        fprintf(file,
+            "int f%d() { int a = %d; int b = a * 3 - %d; int i = 0;\n"
+            "    for (i = 0; i < 10; i = i + 1) { if (i == a) { b = b - i; } else { b = b + i / 2; } }\n"
+            "    return a <= b ? b : a >= 2; }\n",
+            i, i % 13, i % 5);
+    }
+    fprintf(file, "int main() { return 0; }\n");
+    return fclose(file) != 0;
+}
+
+int main() {
+    static const int sizes[] = { 500, 5000, 30000 };
+    char dir[] = "/tmp/c3-bench-cache-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("Failed to create cache directory");
+        return 1;
+    }
+    char path[1100];
+    snprintf(path, sizeof(path), "%s.c", dir);
+
+    printf("ast cache: best time, cold -> warm\n");
+    printf("%10s %10s %24s %24s\n", "functions", "bytes", "front end (ms)", "with codegen (ms)");
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !failed; i++) {
+        if (writeSource(path, sizes[i]) != 0) {
+            failed = 1;
+            break;
+        }
+        FILE *file = fopen(path, "r");
+        fseek(file, 0, SEEK_END);
+        long bytes = ftell(file);
+        fclose(file);
+
+        double times[2][2];
+        for (int generate = 0; generate < 2; generate++) {
+            int hits = 0;
+            BEST_OF(times[generate][0], 1.0, clearCache(dir); hits += compile(path, dir, generate));
+            compile(path, dir, generate); // Leave an entry for the warm runs
+            int misses = 0;
+            BEST_OF(times[generate][1], 1.0, misses += !compile(path, dir, generate));
+            if (hits || misses) {
+                printf("ast cache: unexpected %s\n", hits ? "hit on a cold run" : "miss on a warm run");
+                failed = 1;
+            }
+        }
+        printf("%10d %10ld %11.2f -> %9.2f %11.2f -> %9.2f\n", sizes[i], bytes,
+            times[0][0] * 1e3, times[0][1] * 1e3, times[1][0] * 1e3, times[1][1] * 1e3);
+    }
+    clearCache(dir);
+    rmdir(dir);
+    unlink(path);
+    return failed;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data.h"
+#include "bench.h"
+
+// HashMap insert, lookup hit, lookup miss and delete, from 10 to 10M
+// keys, against the map it replaced: linear probing from key % capacity,
+// growing at 3/4 full, with deletion that empties the slot in place
+// (which cuts off keys probed past it, so its lookups after a delete
+// aren't to be trusted; deletes are timed last).
+
+typedef struct {
+    size_t size;
+    size_t capacity;
+    HashMapEntry *entries;
+} OldMap;
+
+static void oldInsert(OldMap *map, Symbol key, int value);
+
+static OldMap *oldCreate(size_t capacity) {
+    OldMap *map = malloc(sizeof(OldMap));
+    map->capacity = capacity;
+    map->size = 0;
+    map->entries = malloc(capacity * sizeof(HashMapEntry));
+    for (size_t i = 0; i < capacity; i++) {
+        map->entries[i].key = NO_SYMBOL;
+        map->entries[i].value = -1;
+    }
+    return map;
+}
+
+static void oldFree(OldMap *map) {
+    free(map->entries);
+    free(map);
+}
+
+static int oldGet(OldMap *map, Symbol key) {
+    size_t index = (size_t)key % map->capacity;
+    for (size_t i = 0; i < map->capacity; i++) {
+        size_t probe = (index + i) % map->capacity;
+        if (map->entries[probe].key == NO_SYMBOL) {
+            return -1;
+        }
+        if (map->entries[probe].key == key) {
+            return map->entries[probe].value;
+        }
+    }
+    return -1;
+}
+
+static void oldGrow(OldMap *map) {
+    HashMapEntry *old = map->entries;
+    size_t oldCapacity = map->capacity;
+    map->capacity *= 2;
+    map->entries = malloc(map->capacity * sizeof(HashMapEntry));
+    for (size_t i = 0; i < map->capacity; i++) {
+        map->entries[i].key = NO_SYMBOL;
+        map->entries[i].value = -1;
+    }
+    map->size = 0;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (old[i].key != NO_SYMBOL) {
+            oldInsert(map, old[i].key, old[i].value);
+        }
+    }
+    free(old);
+}
+
+static void oldInsert(OldMap *map, Symbol key, int value) {
+    if ((map->size + 1) * 4 > map->capacity * 3) {
+        oldGrow(map);
+    }
+    size_t index = (size_t)key % map->capacity;
+    for (size_t i = 0; i < map->capacity; i++) {
+        size_t probe = (index + i) % map->capacity;
+        if (map->entries[probe].key == NO_SYMBOL) {
+            map->entries[probe].key = key;
+            map->entries[probe].value = value;
+            map->size++;
+            return;
+        }
+        if (map->entries[probe].key == key) {
+            map->entries[probe].value = value;
+            return;
+        }
+    }
+}
+
+static void oldRemove(OldMap *map, Symbol key) {
+    size_t index = (size_t)key % map->capacity;
+    for (size_t i = 0; i < map->capacity; i++) {
+        size_t probe = (index + i) % map->capacity;
+        if (map->entries[probe].key == NO_SYMBOL) {
+            return;
+        }
+        if (map->entries[probe].key == key) {
+            map->entries[probe].key = NO_SYMBOL;
+            map->entries[probe].value = -1;
+            map->size--;
+            return;
+        }
+    }
+}
+
+// Both maps behind one interface, so each pays the same call overhead.
+typedef struct {
+    void *(*create)(void);
+    void (*destroy)(void *map);
+    void (*insert)(void *map, Symbol key, int value);
+    int (*get)(void *map, Symbol key);
+    void (*remove)(void *map, Symbol key);
+} MapOps;
+
+static void *oldCreateOp(void) { return oldCreate(64); }
+static void oldFreeOp(void *map) { oldFree(map); }
+static void oldInsertOp(void *map, Symbol key, int value) { oldInsert(map, key, value); }
+static int oldGetOp(void *map, Symbol key) { return oldGet(map, key); }
+static void oldRemoveOp(void *map, Symbol key) { oldRemove(map, key); }
+
+static void *newCreateOp(void) { return createHashmap(64); }
+static void newFreeOp(void *map) { freeHashmap(map); }
+static void newInsertOp(void *map, Symbol key, int value) { insertHash(map, key, value); }
+static int newGetOp(void *map, Symbol key) { return getHash(map, key); }
+static void newRemoveOp(void *map, Symbol key) { removeHash(map, key); }
+
+static const MapOps oldOps = { oldCreateOp, oldFreeOp, oldInsertOp, oldGetOp, oldRemoveOp };
+static const MapOps newOps = { newCreateOp, newFreeOp, newInsertOp, newGetOp, newRemoveOp };
+
+// Distinct keys spread over [0, 2^30): odd multiplies and xor-shifts are
+// both invertible mod 2^30.
+static Symbol spread(uint32_t i) {
+    const uint32_t mask = (1u << 30) - 1;
+    uint32_t x = (i * 0x2C1B3C6Du) & mask;
+    x ^= x >> 15;
+    x = (x * 0x297A2D39u) & mask;
+    x ^= x >> 15;
+    return (Symbol)x;
+}
+
+// ns per operation for insert, hit, miss and delete over keys, averaged
+// over enough rounds that small maps are timed over ~2M operations.
+static void measure(const MapOps *ops, const Symbol *keys, const Symbol *misses,
+                    size_t count, double ns[4]) {
+    size_t rounds = 1 + 2000000 / count;
+    double total[4] = { 0, 0, 0, 0 };
+    volatile int sink = 0;
+    for (size_t r = 0; r < rounds; r++) {
+        void *map = ops->create();
+        double start = seconds();
+        for (size_t i = 0; i < count; i++) {
+            ops->insert(map, keys[i], (int)i);
+        }
+        double inserted = seconds();
+        for (size_t i = 0; i < count; i++) {
+            sink += ops->get(map, keys[i]);
+        }
+        double hit = seconds();
+        for (size_t i = 0; i < count; i++) {
+            sink += ops->get(map, misses[i]);
+        }
+        double missed = seconds();
+        for (size_t i = 0; i < count; i++) {
+            ops->remove(map, keys[i]);
+        }
+        double removed = seconds();
+        ops->destroy(map);
+        total[0] += inserted - start;
+        total[1] += hit - inserted;
+        total[2] += missed - hit;
+        total[3] += removed - missed;
+    }
+    for (int i = 0; i < 4; i++) {
+        ns[i] = total[i] / ((double)rounds * count) * 1e9;
+    }
+}
+
+int main() {
+    static const size_t sizes[] = { 10, 100, 1000, 10000, 100000, 1000000, 10000000 };
+    size_t largest = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    Symbol *keys = malloc(largest * sizeof(Symbol));
+    Symbol *misses = malloc(largest * sizeof(Symbol));
+    for (int pattern = 0; pattern < 2; pattern++) {
+        for (size_t i = 0; i < largest; i++) {
+            keys[i] = pattern == 0 ? (Symbol)(i * 7) : spread((uint32_t)i);
+            misses[i] = pattern == 0 ? (Symbol)(i * 7 + 3) : spread((uint32_t)(i + largest));
+        }
+        printf("hashmap: ns/op, old -> new, keys %s\n",
+            pattern == 0 ? "i*7" : "spread over 2^30");
+        printf("%9s %16s %16s %16s %16s\n", "keys", "insert", "hit", "miss", "delete");
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            double before[4], after[4];
+            measure(&oldOps, keys, misses, sizes[s], before);
+            measure(&newOps, keys, misses, sizes[s], after);
+            printf("%9zu", sizes[s]);
+            for (int i = 0; i < 4; i++) {
+                printf(" %7.1f->%-7.1f", before[i], after[i]);
+            }
+            printf("\n");
+        }
+    }
+    free(keys);
+    free(misses);
+    return 0;
+}
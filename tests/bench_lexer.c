@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lexer.h"
+#include "bench.h"
+
+// Lexer throughput over generated sources from 1 KB to 100 MB. Time per
+// byte should stay flat as the input grows: lexing is a single pass.
+
+// Append generated functions to text until it holds about size bytes.
+// Every function has its own name, so the interner keeps growing too.
+static size_t generate(char *text, size_t size) {
+    size_t length = 0;
+    for (int i = 0; length < size; i++) {
+        char function[256];
+        int n = snprintf(function, sizeof(function),
+            "int f%d() { int a = %d; int b = 0x%x;\n"
+            "    for (a = 0; a < 10; a = a + 1) { if (a >= b) { b = b * 3 - a / 2; } }\n"
+            "    return a <= b ? !b : ~a && b != 017; }\n",
+            i, i % 97, i % 4096);
+        if (length + n > size) {
+            break;
+        }
+        memcpy(text + length, function, n);
+        length += n;
+    }
+    return length;
+}
+
+static size_t lexAll(const char *text, size_t length) {
+    Interner *interner = createInterner();
+    Lexer *lexer = createLexer(text, length, interner);
+    Token token;
+    size_t count = 0;
+    while (lexerNextToken(lexer, &token)) {
+        count++;
+    }
+    free(lexer);
+    freeInterner(interner);
+    return count;
+}
+
+int main() {
+    static const size_t sizes[] = {
+        1 << 10, 10 << 10, 100 << 10, 1 << 20, 10 << 20, 100 << 20,
+    };
+    size_t largest = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    char *text = malloc(largest);
+    printf("lexer: best time per input size\n");
+    printf("%12s %12s %10s %10s %12s\n", "bytes", "tokens", "ms", "MB/s", "Mtokens/s");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t length = generate(text, sizes[i]);
+        size_t tokens = 0;
+        double best;
+        BEST_OF(best, 0.5, tokens = lexAll(text, length));
+        printf("%12zu %12zu %10.3f %10.1f %12.2f\n", length, tokens, best * 1e3,
+            length / best / 1e6, tokens / best / 1e6);
+    }
+    free(text);
+    return 0;
+}
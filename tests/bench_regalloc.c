@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "generator.h"
+#include "assembler.h"
+#include "linker.h"
+#include "bench.h"
+
+// Runtime of generated loop-heavy programs: a 3000x3000 nested loop
+// updating a few locals. Each is compiled twice, once as c3 compiles it
+// and once with no registers for the allocator to hand out, so every
+// vreg lives in a stack slot, and both executables are run.
+
+#define PROGRAMS 8
+#define TRIP 3000
+
+extern char **environ;
+
+// Deterministic pseudo-random numbers, so every run builds the same programs.
+static unsigned long long state;
+
+static int pick(int n) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (int)((state >> 33) % n);
+}
+
+static const char *const variables[] = { "a", "b", "c", "d", "i", "j" };
+static const char *const operators[] = { "+", "-", "*", "+", "-", "<", ">=" };
+
+static void writeExpression(FILE *file, int depth) {
+    if (depth > 1 || pick(10) < 3) {
+        int choice = pick(7);
+        if (choice < 6) {
+            fputs(variables[choice], file);
+        } else {
+            fprintf(file, "%d", 1 + pick(8));
+        }
+        return;
+    }
+    fputc('(', file);
+    writeExpression(file, depth + 1);
+    if (pick(100) < 15) {
+        fprintf(file, " / %d)", 2 + pick(7));
+        return;
+    }
+    fprintf(file, " %s ", operators[pick(7)]);
+    writeExpression(file, depth + 1);
+    fputc(')', file);
+}
+
+static int writeProgram(const char *path, int seed) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to create benchmark source");
+        return 1;
+    }
+    state = seed;
+    fprintf(file, "int main() { int a = 1; int b = 2; int c = 3; int d = 4; int i = 0; int j = 0;\n"
+                  "    for (i = 0; i < %d; i = i + 1) { for (j = 0; j < %d; j = j + 1) {\n", TRIP, TRIP);
+    int statements = 3 + pick(3);
+    for (int s = 0; s < statements; s++) {
+        fprintf(file, "        %s = ", variables[pick(4)]);
+        writeExpression(file, 0);
+        fputs(";\n", file);
+    }
+    fputs("        if (a > 100000) { a = a / 3; } } }\n"
+          "    return a + b + c + d; }\n", file);
+    return fclose(file) != 0;
+}
+
+// Compile path to the executable output, with no registers to allocate
+// if stackOnly is set. Returns main's stack slots, or -1 on failure.
+static int compile(const char *path, const char *output, int stackOnly) {
+    CompilerContext *ctx = createContext(path);
+    TokenStream *stream = createTokenStream(ctx->source, ctx->interner);
+    Parser parser;
+    initParser(&parser, ctx, createAST());
+    parser.stream = stream;
+    AST *ast = parser.ast;
+    parseProgram(&parser);
+    int failed = parser.errorFlag;
+    freeParser(&parser);
+
+    CodeGenerator generator;
+    initCodeGenerator(&generator, ctx);
+    if (stackOnly) {
+        generator.regs.allowedRegisters = 0;
+    }
+    Assembler *assembler = createAssembler(ctx->interner);
+    failed = failed || generateX86(&generator, ast) != 0
+          || assembleText(assembler, generator.sb.data, generator.sb.length) != 0
+          || finishAssembly(assembler) != 0
+          || linkExecutable(assembler, output) != 0;
+    int slots = failed ? -1 : generator.regs.spillSlots;
+    freeAssembler(assembler);
+    freeCodeGenerator(&generator);
+    freeAST(ast);
+    freeTokenStream(stream);
+    freeContext(ctx);
+    return slots;
+}
+
+// Run an executable; returns its exit status, or -1 if it didn't exit.
+static int run(const char *path) {
+    char *argv[] = { (char *)path, NULL };
+    pid_t pid;
+    int status;
+    if (posix_spawn(&pid, path, NULL, NULL, argv, environ) != 0
+        || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+int main() {
+    char source[] = "/tmp/c3-bench-regalloc-XXXXXX.c";
+    int fd = mkstemps(source, 2);
+    if (fd < 0) {
+        perror("Failed to create benchmark source");
+        return 1;
+    }
+    close(fd);
+    char allocated[64], stacked[64];
+    snprintf(allocated, sizeof(allocated), "%.*s-reg", (int)strlen(source) - 2, source);
+    snprintf(stacked, sizeof(stacked), "%.*s-stack", (int)strlen(source) - 2, source);
+
+    printf("regalloc: best runtime of %dx%d loops, stack slots only -> allocated\n", TRIP, TRIP);
+    printf("%6s %22s %14s %10s\n", "seed", "ms", "slots", "exit");
+    double totals[2] = { 0, 0 };
+    int failed = 0;
+    for (int seed = 1; seed <= PROGRAMS && !failed; seed++) {
+        int slots[2] = { -1, -1 };
+        if (writeProgram(source, seed) == 0) {
+            slots[0] = compile(source, stacked, 1);
+            slots[1] = compile(source, allocated, 0);
+        }
+        if (slots[0] < 0 || slots[1] < 0) {
+            printf("regalloc: seed %d failed to compile\n", seed);
+            failed = 1;
+            break;
+        }
+        int status[2];
+        double best[2];
+        BEST_OF(best[0], 0.3, status[0] = run(stacked));
+        BEST_OF(best[1], 0.3, status[1] = run(allocated));
+        if (status[0] < 0 || status[0] != status[1]) {
+            printf("regalloc: seed %d exited with %d and %d\n", seed, status[0], status[1]);
+            failed = 1;
+        }
+        totals[0] += best[0];
+        totals[1] += best[1];
+        printf("%6d %9.1f -> %9.1f %5d -> %5d %10d\n", seed, best[0] * 1e3, best[1] * 1e3,
+            slots[0], slots[1], status[1]);
+    }
+    if (!failed) {
+        printf("%6s %9.1f -> %9.1f (%.1fx)\n", "total", totals[0] * 1e3, totals[1] * 1e3,
+            totals[0] / totals[1]);
+    }
+    unlink(source);
+    unlink(allocated);
+    unlink(stacked);
+    return failed;
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "parallel.h"
+#include "generator.h"
+#include "assembler.h"
+
+// Compiles one source serially on the main thread, then on several
+// threads at once, each with its own context, and checks that every
+// thread produces the same assembly and the same .text as the serial
+// compile. The source is big enough that each threaded compile also
+// parses on worker threads of its own.
+
+#define THREADS 8
+#define JOBS 2
+#define FUNCTIONS 1500
+
+typedef struct {
+    const char *path;
+    int jobs;               // Parser threads; 1 parses on the calling thread
+    char *assembly;
+    size_t assemblyLength;
+    unsigned char *text;
+    size_t textLength;
+    int failed;
+} Compile;
+
+static void *compile(void *arg) {
+    Compile *compile = arg;
+    compile->failed = 1;
+    CompilerContext *ctx = createContext(compile->path);
+    if (!ctx) {
+        return NULL;
+    }
+    TokenBuffer *tokens = lex(ctx->source, ctx->interner);
+    int errorFlag = 0;
+    MemCounter parserMem = { 0, 0, 0 };
+    AST *ast = parseParallel(ctx, tokens, compile->jobs, &errorFlag, &parserMem);
+
+    CodeGenerator generator;
+    initCodeGenerator(&generator, ctx);
+    if (!errorFlag && generateX86(&generator, ast) == 0) {
+        compile->assemblyLength = generator.sb.length;
+        compile->assembly = malloc(generator.sb.length);
+        memcpy(compile->assembly, generator.sb.data, generator.sb.length);
+
+        Assembler *assembler = createAssembler(ctx->interner);
+        if (assembleText(assembler, generator.sb.data, generator.sb.length) == 0
+            && finishAssembly(assembler) == 0) {
+            compile->textLength = assembler->textLength;
+            compile->text = malloc(assembler->textLength);
+            memcpy(compile->text, assembler->text, assembler->textLength);
+            compile->failed = 0;
+        }
+        freeAssembler(assembler);
+    }
+    freeCodeGenerator(&generator);
+    freeAST(ast);
+    freeTokenBuffer(tokens);
+    freeContext(ctx);
+    return NULL;
+}
+
+// Write FUNCTIONS functions mixing declarations, scopes, branches, loops
+// and the operators the code generator handles.
+static int writeSource(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to create test source");
+        return 1;
+    }
+    for (int i = 0; i < FUNCTIONS; i++) {
+        fprintf(file,
+            "int f%d() { int a = %d; int b = a * 3 - %d; int i = 0;\n"
+            "    for (i = 0; i < %d; i = i + 1) { if (i == a) { b = b - i; } else { b = b + i / 2; } }\n"
+            "    { int a = b / 2; b = a > 4 ? a - b : -a; }\n"
+            "    b = ~b || !a && b != 3;\n"
+            "    return a <= b ? b : a >= 2; }\n",
+            i, i % 13, i % 5, i % 11 + 2);
+    }
+    fprintf(file, "int main() { return 0; }\n");
+    return fclose(file) != 0;
+}
+
+int main() {
+    char path[] = "/tmp/c3-concurrent-XXXXXX.c";
+    int fd = mkstemps(path, 2);
+    if (fd < 0) {
+        perror("Failed to create test source");
+        return 1;
+    }
+    close(fd);
+    if (writeSource(path) != 0) {
+        unlink(path);
+        return 1;
+    }
+
+    // The reference: nothing else runs while it compiles.
+    Compile serial;
+    memset(&serial, 0, sizeof(serial));
+    serial.path = path;
+    serial.jobs = 1;
+    compile(&serial);
+    if (serial.failed) {
+        printf("concurrent: serial compile failed\n");
+        unlink(path);
+        return 1;
+    }
+
+    Compile compiles[THREADS];
+    pthread_t threads[THREADS];
+    memset(compiles, 0, sizeof(compiles));
+    for (int i = 0; i < THREADS; i++) {
+        compiles[i].path = path;
+        compiles[i].jobs = JOBS;
+        pthread_create(&threads[i], NULL, compile, &compiles[i]);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    unlink(path);
+
+    int failed = 0;
+    for (int i = 0; i < THREADS; i++) {
+        const Compile *reference = &serial;
+        const Compile *compile = &compiles[i];
+        if (compile->failed) {
+            printf("concurrent: compile %d failed\n", i);
+            failed = 1;
+        } else if (compile->assemblyLength != reference->assemblyLength
+                   || memcmp(compile->assembly, reference->assembly, reference->assemblyLength) != 0) {
+            printf("concurrent: compile %d produced different assembly from the serial compile\n", i);
+            failed = 1;
+        } else if (compile->textLength != reference->textLength
+                   || memcmp(compile->text, reference->text, reference->textLength) != 0) {
+            printf("concurrent: compile %d produced a different .text from the serial compile\n", i);
+            failed = 1;
+        }
+    }
+    for (int i = 0; i < THREADS; i++) {
+        free(compiles[i].assembly);
+        free(compiles[i].text);
+    }
+    if (!failed) {
+        printf("concurrent: %d compiles, %zu bytes of .text each, all identical to a serial compile\n",
+            THREADS, serial.textLength);
+    }
+    free(serial.assembly);
+    free(serial.text);
+    return failed;
+}